@@ -532,11 +532,8 @@ static void online(uint64_t name,
 
     ct_cdb_a0->load(_G.db, data, obj, _G.allocator);
 
+    // Data is owned by cdb now, it can be freed if load is rejected.
     _load(obj, 0);
-
-    ct_cdb_obj_o *writer = ct_cdb_a0->write_begin(obj);
-    ct_cdb_a0->set_ptr(writer, PROP_RESOURECE_DATA, data);
-    ct_cdb_a0->write_commit(writer);
 }
 
 static void offline(uint64_t name,
@@ -685,10 +682,16 @@ static struct ct_entity _spawn_entity(struct ct_world world,
     uint64_t children_keys[children_n];
     ct_cdb_a0->prop_keys(children, children_keys);
 
+    // Child is spawned from resource child. Reading it through instance
+    // would instance it only to be replaced by spawned one.
+    uint64_t resource_children;
+    resource_children = ct_cdb_a0->read_subobject(resource_ent,
+                                                  ENTITY_CHILDREN, 0);
 
     for (int i = 0; i < children_n; ++i) {
         uint64_t child;
-        child = ct_cdb_a0->read_subobject(children, children_keys[i], 0);
+        child = ct_cdb_a0->read_subobject(resource_children,
+                                          children_keys[i], 0);
 
         uint64_t new_obj = _spawn_entity(world, child).h;
 
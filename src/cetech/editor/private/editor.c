@@ -19,6 +19,8 @@
 #include <cetech/command_system/command_system.h>
 #include <cetech/action_manager/action_manager.h>
 #include <corelib/ebus.h>
+#include <corelib/task.h>
+#include <corelib/config.h>
 #include <cetech/kernel/kernel.h>
 #include <cetech/render_graph/render_graph.h>
 #include <cetech/dock/dock.h>
@@ -62,6 +64,24 @@ static float draw_main_menu() {
                 ct_renderer_a0->set_debug(debug);
             }
 
+            if (ct_debugui_a0->BeginMenu("Task trace", true)) {
+                uint64_t config = ct_config_a0->obj();
+                bool trace = ct_cdb_a0->read_uint64(config,
+                                                    CONFIG_TASK_TRACE, 0) > 0;
+
+                if (ct_debugui_a0->MenuItem2("Record", NULL, &trace, true)) {
+                    ct_cdb_obj_o *w = ct_cdb_a0->write_begin(config);
+                    ct_cdb_a0->set_uint64(w, CONFIG_TASK_TRACE, trace);
+                    ct_cdb_a0->write_commit(w);
+                }
+
+                if (ct_debugui_a0->MenuItem("Dump", NULL, false, true)) {
+                    ct_task_a0->trace_dump("task_trace.json");
+                }
+
+                ct_debugui_a0->EndMenu();
+            }
+
             if (ct_debugui_a0->MenuItem("Quit", "Alt+F4", false, true)) {
                 uint64_t event = ct_cdb_a0->create_object(
                         ct_cdb_a0->db(),
@@ -341,6 +361,8 @@ CETECH_MODULE_DEF(
             CT_INIT_API(api, ct_ebus_a0);
             CT_INIT_API(api, ct_render_graph_a0);
             CT_INIT_API(api, ct_cdb_a0);
+            CT_INIT_API(api, ct_config_a0);
+            CT_INIT_API(api, ct_task_a0);
         },
         {
             CT_UNUSED(reload);
@@ -109,6 +109,9 @@ int cetech_kernel_init(int argc,
 
     init_config(argc, argv, ct_config_a0->obj());
 
+    // Workers read task config, start them after it is loaded.
+    ct_task_a0->start();
+
     CETECH_ADD_STATIC_MODULE(builddb);
     CETECH_ADD_STATIC_MODULE(resourcesystem);
     CETECH_ADD_STATIC_MODULE(resourcecompiler);
@@ -197,11 +200,13 @@ static void _boot_stage() {
 
     ct_resource_a0->load_now(pkg, resources, 2);
 
+    // Core package load after boot package without waiting on main thread.
     struct ct_task_counter_t *boot_pkg_cnt = ct_package_a0->load(boot_pkg);
-    ct_package_a0->flush(boot_pkg_cnt);
+    struct ct_task_counter_t *core_pkg_cnt = ct_package_a0->load_after(
+            core_pkg, boot_pkg_cnt);
 
-    struct ct_task_counter_t *core_pkg_cnt = ct_package_a0->load(core_pkg);
     ct_package_a0->flush(core_pkg_cnt);
+    ct_package_a0->flush(boot_pkg_cnt);
 }
 
 static void _boot_unload() {
@@ -250,6 +255,9 @@ static void cetech_kernel_start() {
 
     _G.is_running = 1;
 
+    // Notify once per frame, not on every commit.
+    ct_cdb_a0->set_notify_deferred(true);
+
     const uint64_t fq = ct_os_a0->time->perf_freq();
     uint64_t last_tick = ct_os_a0->time->perf_counter();
     while (_G.is_running) {
@@ -269,9 +277,12 @@ static void cetech_kernel_start() {
 
         ct_ebus_a0->broadcast(KERNEL_EBUS, event);
 
+        ct_cdb_a0->flush_notify();
         ct_cdb_a0->gc();
     }
 
+    ct_cdb_a0->set_notify_deferred(false);
+
     event = ct_cdb_a0->create_object(ct_cdb_a0->db(), KERNEL_SHUTDOWN_EVENT);
 
     ct_ebus_a0->broadcast(KERNEL_EBUS, event);
@@ -25,6 +25,11 @@ struct ct_task_counter_t;
 struct ct_package_a0 {
     struct ct_task_counter_t *(*load)(uint64_t name);
 
+    //! Load package after dep counter reach zero. Dep is not consumed,
+    //! caller still flush it. Counter of empty package is done at once.
+    struct ct_task_counter_t *(*load_after)(uint64_t name,
+                                            struct ct_task_counter_t *dep);
+
     void (*unload)(uint64_t name);
 
     int (*is_loaded)(uint64_t name);
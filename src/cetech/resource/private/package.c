@@ -20,10 +20,6 @@
 // Public interface
 //==============================================================================
 
-struct package_task_data {
-    uint64_t name;
-};
-
 #define _G PackageGlobals
 struct _G {
     struct ct_alloc *allocator;
@@ -152,59 +148,56 @@ void package_load_task(void *data) {
     ct_resource_a0->load_now(ct_cdb_a0->type(type_obj), names, name_n);
 }
 
-void package_task(void *data) {
-    struct package_task_data *task_data = (struct package_task_data *) data;
-
+struct ct_task_counter_t *package_load_after(uint64_t name,
+                                             struct ct_task_counter_t *dep) {
     struct ct_resource_id rid = (struct ct_resource_id) {
             .type = PACKAGE_TYPE,
-            .name = task_data->name
+            .name = name
     };
 
     uint64_t obj = ct_resource_a0->get(rid);
     uint64_t types_obj = ct_cdb_a0->read_subobject(obj, PACKAGE_TYPES_PROP, 0);
 
-    struct ct_task_item *load_tasks = NULL;
+    struct ct_task_counter_t *counter = NULL;
+
     const uint64_t type_n = ct_cdb_a0->prop_count(types_obj);
-    uint64_t types[type_n];
+
+    // Empty package, counter is done.
+    if (!type_n) {
+        ct_task_a0->add(NULL, 0, &counter);
+        return counter;
+    }
+
+    uint64_t *types = CT_ALLOC(_G.allocator, uint64_t,
+                               sizeof(uint64_t) * type_n);
     ct_cdb_a0->prop_keys(types_obj, types);
 
+    struct ct_task_item *load_tasks = CT_ALLOC(_G.allocator,
+                                               struct ct_task_item,
+                                               sizeof(struct ct_task_item) *
+                                               type_n);
+
     for (uint32_t j = 0; j < type_n; ++j) {
         uint64_t type_obj = ct_cdb_a0->read_subobject(types_obj, types[j], 0);
 
-        struct ct_task_item item = {
-                .name = "package_task",
+        load_tasks[j] = (struct ct_task_item) {
+                .name = "package_load_task",
                 .work = package_load_task,
                 .data = (void *) type_obj,
+                .priority = TASK_PRIORITY_BACKGROUND,
         };
-
-        ct_array_push(load_tasks, item, _G.allocator);
     }
 
-    struct ct_task_counter_t *counter = NULL;
-    ct_task_a0->add(load_tasks, type_n, &counter);
-    ct_task_a0->wait_for_counter(counter, 0);
+    ct_task_a0->add_after(load_tasks, type_n, &dep, dep ? 1 : 0, &counter);
+
+    CT_FREE(_G.allocator, load_tasks);
+    CT_FREE(_G.allocator, types);
 
-    CT_FREE(_G.allocator, task_data);
+    return counter;
 }
 
 struct ct_task_counter_t *package_load(uint64_t name) {
-    struct package_task_data *task_data =
-            CT_ALLOC(_G.allocator,
-                     struct package_task_data,
-                     sizeof(struct package_task_data));
-
-    task_data->name = name;
-
-    struct ct_task_item item = {
-            .name = "package_task",
-            .work = package_task,
-            .data = task_data,
-    };
-
-    struct ct_task_counter_t *counter = NULL;
-    ct_task_a0->add(&item, 1, &counter);
-
-    return counter;
+    return package_load_after(name, NULL);
 }
 
 void package_unload(uint64_t name) {
@@ -346,6 +346,7 @@ static struct ct_resource_a0 resource_api = {
 
 static struct ct_package_a0 package_api = {
         .load = package_load,
+        .load_after = package_load_after,
         .unload = package_unload,
         .is_loaded = package_is_loaded,
         .flush = package_flush,
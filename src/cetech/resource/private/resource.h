@@ -44,6 +44,9 @@ void package_shutdown();
 
 struct ct_task_counter_t *package_load(uint64_t name);
 
+struct ct_task_counter_t *package_load_after(uint64_t name,
+                                             struct ct_task_counter_t *dep);
+
 void package_unload(uint64_t name);
 
 int package_is_loaded(uint64_t name);
@@ -203,7 +203,8 @@ void _compile_files(struct ct_task_item **tasks,
         struct ct_task_item item = {
                 .name = "compiler_task",
                 .work = _compile_task,
-                .data = data
+                .data = data,
+                .priority = TASK_PRIORITY_BACKGROUND,
         };
 
         ct_array_push(*tasks, item, _G.allocator);
@@ -69,15 +69,16 @@ static void online(uint64_t name,
     uint32_t *ib = (ct_cdb_a0->read_blob(obj, SCENE_IB_PROP, NULL, NULL));
     uint8_t *vb = (ct_cdb_a0->read_blob(obj, SCENE_VB_PROP, NULL, NULL));
 
+    // Buffers live in cdb load buffer, renderer needs own copy.
     ct_cdb_obj_o *writer = ct_cdb_a0->write_begin(obj);
     for (uint32_t i = 0; i < geom_count; ++i) {
         const ct_render_memory_t *vb_mem;
-        vb_mem = ct_renderer_a0->make_ref((const void *) &vb[vb_offset[i]],
-                                          vb_size[i]);
+        vb_mem = ct_renderer_a0->copy((const void *) &vb[vb_offset[i]],
+                                      vb_size[i]);
 
         const ct_render_memory_t *ib_mem;
-        ib_mem = ct_renderer_a0->make_ref((const void *) &ib[ib_offset[i]],
-                                          sizeof(uint32_t) * ib_size[i]);
+        ib_mem = ct_renderer_a0->copy((const void *) &ib[ib_offset[i]],
+                                      sizeof(uint32_t) * ib_size[i]);
 
         ct_render_vertex_buffer_handle_t bv_handle;
         bv_handle = ct_renderer_a0->create_vertex_buffer(vb_mem,
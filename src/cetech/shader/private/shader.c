@@ -268,10 +268,11 @@ static void online(uint64_t name,
     void *vs_blob;
     vs_blob = ct_cdb_a0->read_blob(obj, SHADER_VS_DATA, &vs_blob_size, 0);
 
-    const ct_render_memory_t *vs_mem = ct_renderer_a0->make_ref(vs_blob,
-                                                                vs_blob_size);
-    const ct_render_memory_t *fs_mem = ct_renderer_a0->make_ref(fs_blob,
-                                                                fs_blob_size);
+    // Blobs live in cdb load buffer, renderer needs own copy.
+    const ct_render_memory_t *vs_mem = ct_renderer_a0->copy(vs_blob,
+                                                            vs_blob_size);
+    const ct_render_memory_t *fs_mem = ct_renderer_a0->copy(fs_blob,
+                                                            fs_blob_size);
 
     ct_render_shader_handle_t vs_shader = ct_renderer_a0->create_shader(vs_mem);
     ct_render_shader_handle_t fs_shader = ct_renderer_a0->create_shader(fs_mem);
@@ -68,7 +68,9 @@ void _texture_resource_online(uint64_t name,
     void *blob;
     blob = ct_cdb_a0->read_blob(obj, TEXTURE_DATA, &blob_size, 0);
 
-    const ct_render_memory_t *mem = ct_renderer_a0->make_ref(blob, blob_size);
+    // Blob live in cdb load buffer freed with last object version,
+    // renderer create texture later so it needs own copy.
+    const ct_render_memory_t *mem = ct_renderer_a0->copy(blob, blob_size);
 
     ct_render_texture_handle_t texture;
     texture = ct_renderer_a0->create_texture(mem,
@@ -209,8 +211,8 @@ static void _on_obj_change(uint64_t obj,
         uint64_t blob_size = 0;
         void *blob;
         blob = ct_cdb_a0->read_blob(obj, TEXTURE_DATA, &blob_size, 0);
-        const ct_render_memory_t *mem = ct_renderer_a0->make_ref(blob,
-                                                                 blob_size);
+        const ct_render_memory_t *mem = ct_renderer_a0->copy(blob,
+                                                             blob_size);
 
         ct_render_texture_handle_t texture;
         texture = ct_renderer_a0->create_texture(mem,
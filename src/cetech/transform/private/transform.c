@@ -199,28 +199,29 @@ void transform_transform(struct ct_transform_comp *transform,
 }
 
 
-static void _on_component_obj_change(uint64_t obj,
-                                     const uint64_t *prop,
-                                     uint32_t prop_count,
+static void _on_component_obj_change(const struct ct_cdb_change_t *changes,
+                                     uint32_t changes_count,
                                      void *data) {
+    for (uint32_t i = 0; i < changes_count; ++i) {
+        uint64_t obj = changes[i].obj;
+        uint64_t ent_obj = ct_cdb_a0->parent(ct_cdb_a0->parent(obj));
 
-    uint64_t ent_obj = ct_cdb_a0->parent(ct_cdb_a0->parent(obj));
-
-    struct ct_world world = {
-            .h = ct_cdb_a0->read_uint64(ent_obj, ENTITY_WORLD, 0)
-    };
+        struct ct_world world = {
+                .h = ct_cdb_a0->read_uint64(ent_obj, ENTITY_WORLD, 0)
+        };
 
-    struct ct_entity ent = {.h = ent_obj};
+        struct ct_entity ent = {.h = ent_obj};
 
-    struct ct_transform_comp *transform;
-    transform = ct_ecs_a0->component->get_one(world, TRANSFORM_COMPONENT,
-                                                  ent);
+        struct ct_transform_comp *transform;
+        transform = ct_ecs_a0->component->get_one(world, TRANSFORM_COMPONENT,
+                                                      ent);
 
-    ct_cdb_a0->read_vec3(obj, PROP_POSITION, transform->position);
-    ct_cdb_a0->read_vec3(obj, PROP_ROTATION, transform->rotation);
-    ct_cdb_a0->read_vec3(obj, PROP_SCALE, transform->scale);
+        ct_cdb_a0->read_vec3(obj, PROP_POSITION, transform->position);
+        ct_cdb_a0->read_vec3(obj, PROP_ROTATION, transform->rotation);
+        ct_cdb_a0->read_vec3(obj, PROP_SCALE, transform->scale);
 
-    transform_transform(transform, NULL);
+        transform_transform(transform, NULL);
+    }
 }
 
 
@@ -234,7 +235,7 @@ static void _component_spawner(uint64_t obj,
 
     transform_transform(transform, NULL);
 
-    ct_cdb_a0->register_notify(obj, _on_component_obj_change, NULL);
+    ct_cdb_a0->register_notify_batch(obj, _on_component_obj_change, NULL);
 }
 
 static uint64_t cdb_type() {
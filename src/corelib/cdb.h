@@ -29,11 +29,30 @@ struct ct_cdb_t {
 
 typedef void ct_cdb_obj_o;
 
+// Memory of object and id tables in bytes.
+// Committed is mapped memory, free is committed item memory not in use.
+struct ct_cdb_stats_t {
+    uint64_t live_bytes;
+    uint64_t free_bytes;
+    uint64_t committed_bytes;
+};
+
 typedef void (*ct_cdb_notify)(uint64_t obj,
                               const uint64_t *prop,
                               uint32_t prop_count,
                               void *data);
 
+// Changed properties of object, each property is once.
+struct ct_cdb_change_t {
+    uint64_t obj;
+    const uint64_t *prop;
+    uint32_t prop_count;
+};
+
+typedef void (*ct_cdb_notify_batch)(const struct ct_cdb_change_t *changes,
+                                    uint32_t changes_count,
+                                    void *data);
+
 //==============================================================================
 // Enums
 //==============================================================================
@@ -54,6 +73,44 @@ enum ct_cdb_type {
     CDB_TYPE_BLOB,
 };
 
+union ct_cdb_value_t {
+    uint64_t uint64;
+    void *ptr;
+    uint64_t ref;
+    uint64_t subobject;
+    float f;
+    bool b;
+    const char *str;
+    float vec3[3];
+    float vec4[4];
+    float mat4[16];
+
+    struct {
+        void *data;
+        uint64_t size;
+    } blob;
+};
+
+// Property change from changelog, old type is CDB_TYPE_NONE for new
+// property. Str and blob values are valid until change is trimmed.
+struct ct_cdb_prop_change_t {
+    uint64_t epoch;
+    uint64_t obj;
+    uint64_t prop;
+    enum ct_cdb_type old_type;
+    enum ct_cdb_type new_type;
+    union ct_cdb_value_t old_value;
+    union ct_cdb_value_t new_value;
+};
+
+// Root object in checkpoint image. Key identify object (e.g. source
+// file), source hash is hash of data object was imported from.
+struct ct_cdb_image_entry_t {
+    uint64_t key;
+    uint64_t source_hash;
+    uint64_t obj;
+};
+
 //==============================================================================
 // Interface
 //==============================================================================
@@ -67,6 +124,16 @@ struct ct_cdb_a0 {
                             ct_cdb_notify notify,
                             void *data);
 
+    // Handler get changes of all objects it is registered on in one call.
+    void (*register_notify_batch)(uint64_t obj,
+                                  ct_cdb_notify_batch notify,
+                                  void *data);
+
+    // Deferred notifications are queued on commit, merged by object and
+    // property and sent by flush_notify. Disable flush queued.
+    void (*set_notify_deferred)(bool deferred);
+    void (*flush_notify)();
+
     uint64_t (*create_object)(struct ct_cdb_t db,
                               uint64_t type);
 
@@ -82,15 +149,74 @@ struct ct_cdb_a0 {
 
     void (*gc)();
 
+    void (*stats)(struct ct_cdb_t db,
+                  struct ct_cdb_stats_t *stats);
+
+    // Query copy up to max objects to objs and return count of all.
+    uint32_t (*query_type)(struct ct_cdb_t db,
+                           uint64_t type,
+                           uint64_t *objs,
+                           uint32_t max);
+
+    // Index objects of type by uint64, ref, subobject or bool property.
+    void (*create_index)(struct ct_cdb_t db,
+                         uint64_t type,
+                         uint64_t prop);
+
+    uint32_t (*query_value)(struct ct_cdb_t db,
+                            uint64_t type,
+                            uint64_t prop,
+                            uint64_t value,
+                            uint64_t *objs,
+                            uint32_t max);
+
+    // Changelog record property changes of commits in db. Each commit
+    // has epoch, snapshot is epoch of last commit.
+    void (*set_changelog)(struct ct_cdb_t db,
+                          bool enabled);
+
+    uint64_t (*snapshot)(struct ct_cdb_t db);
+
+    // Copy up to max changes after snapshot and return count of all.
+    uint32_t (*changes)(struct ct_cdb_t db,
+                        uint64_t since,
+                        struct ct_cdb_prop_change_t *changes,
+                        uint32_t max);
+
+    // Own property value of object at snapshot that is not trimmed.
+    enum ct_cdb_type (*read_at)(uint64_t obj,
+                                uint64_t snapshot,
+                                uint64_t prop,
+                                union ct_cdb_value_t *value);
+
+    // Drop changes up to snapshot.
+    void (*trim_changelog)(struct ct_cdb_t db,
+                           uint64_t snapshot);
+
     void (*dump)(uint64_t obj,
                  char **output,
                  struct ct_alloc *allocator);
 
+    // Input is data from dump allocated by allocator. Loaded object use
+    // it in place and cdb free it when no object use it.
     void (*load)(struct ct_cdb_t db,
-                 const char *input,
+                 char *input,
                  uint64_t obj,
                  struct ct_alloc *allocator);
 
+    // Write objects of entries to checkpoint image, keys must be unique.
+    bool (*save_image)(const char *path,
+                       const struct ct_cdb_image_entry_t *entries,
+                       uint32_t entries_count);
+
+    // Map image and load objects of entries whose key and source hash
+    // match, obj of other entries is 0 and must be imported again.
+    // Loaded objects use mapped file in place. Return loaded count.
+    uint32_t (*load_image)(struct ct_cdb_t db,
+                           const char *path,
+                           struct ct_cdb_image_entry_t *entries,
+                           uint32_t entries_count);
+
     // PROP
     bool (*prop_exist)(uint64_t object,
                        uint64_t key);
@@ -164,6 +290,11 @@ struct ct_cdb_a0 {
 
 
     // READ
+    // Data read between begin and end is not freed by gc. Single read is
+    // safe without it, can nest.
+    void (*read_begin)();
+    void (*read_end)();
+
     float (*read_float)(uint64_t object,
                         uint64_t property,
                         float defaultt);
@@ -47,10 +47,12 @@
 // Hash table struct
 //
 // - *n* - bucket size
+// - *count* - used buckets
 // - *keys* - keys [array](array.md.html)
 // - *values* - values [array](array.md.html)
 struct ct_hash_t {
     uint32_t n;
+    uint32_t count;
     uint64_t *keys;
     uint64_t *values;
 };
@@ -60,6 +62,7 @@ struct ct_hash_t {
 static inline void ct_hash_clean(struct ct_hash_t *hash) {
     memset(hash->keys, 255, sizeof(uint64_t) * hash->n);
     hash->n = 0;
+    hash->count = 0;
 
     ct_array_clean(hash->keys);
     ct_array_clean(hash->values);
@@ -71,6 +74,7 @@ static inline void ct_hash_free(struct ct_hash_t *hash,
     ct_array_free(hash->keys, allocator);
     ct_array_free(hash->values, allocator);
     hash->n = 0;
+    hash->count = 0;
 }
 
 static inline uint32_t ct_hash_find_slot(const struct ct_hash_t *hash,
@@ -127,7 +131,13 @@ static inline void ct_hash_add(struct ct_hash_t *hash,
 
     begin:
     idx = ct_hash_find_slot(hash, k);
-    if ((hash->keys[idx] != EMPTY_SLOT) && (hash->keys[idx] != k)) {
+
+    // Grow at 3/4 load, lookup of missing key probe to first empty slot.
+    const bool new_key = hash->keys[idx] != k;
+    const bool full = ((uint64_t) hash->count + 1) * 4 >
+                      (uint64_t) hash->n * 3;
+
+    if (new_key && ((hash->keys[idx] != EMPTY_SLOT) || full)) {
         uint32_t new_size = hash->n * 2;
 
         struct ct_hash_t new_hash = {.n = new_size};
@@ -149,6 +159,7 @@ static inline void ct_hash_add(struct ct_hash_t *hash,
         goto begin;
     }
 
+    hash->count += new_key;
     hash->values[idx] = value;
     hash->keys[idx] = k;
 }
@@ -160,6 +171,7 @@ static inline void ct_hash_remove(struct ct_hash_t *hash,
     if (hash->keys[idx] == k) {
         hash->keys[idx] = EMPTY_SLOT;
         hash->values[idx] = 0;
+        --hash->count;
         return;
     }
 }
@@ -169,6 +181,7 @@ static inline void ct_hash_clone(const struct ct_hash_t *from,
                                  const struct ct_alloc *alloc) {
     struct ct_hash_t tmp_hash = {0};
     tmp_hash.n = from->n;
+    tmp_hash.count = from->count;
 
     if (tmp_hash.n) {
         ct_array_resize(tmp_hash.values, tmp_hash.n, alloc);
@@ -38,6 +38,18 @@ struct ct_os_error_a0 {
 
 struct ct_os_cpu_a0 {
     int (*count)();
+
+    //! NUMA node count (1 if unknown)
+    uint32_t (*numa_node_count)();
+
+    //! Get cpus of NUMA node
+    //! \param node Node
+    //! \param cpus Cpu index array
+    //! \param max_cpus Array size
+    //! \return Cpu count
+    uint32_t (*numa_node_cpus)(uint32_t node,
+                               uint32_t *cpus,
+                               uint32_t max_cpus);
 };
 
 
@@ -138,6 +150,8 @@ struct ct_os_process_a0 {
 
 typedef void ct_thread_t;
 
+typedef void ct_sem_t;
+
 typedef int (*ct_thread_fce_t)(void *data);
 
 struct ct_spinlock {
@@ -178,6 +192,30 @@ struct ct_os_thread_a0 {
     void (*spin_lock)(struct ct_spinlock *lock);
 
     void (*spin_unlock)(struct ct_spinlock *lock);
+
+    //! Create new semaphore
+    //! \param value Initial value
+    //! \return new semaphore
+    ct_sem_t *(*sem_create)(uint32_t value);
+
+    //! Destroy semaphore
+    //! \param sem Semaphore
+    void (*sem_destroy)(ct_sem_t *sem);
+
+    //! Increment semaphore and wake one waiting thread
+    //! \param sem Semaphore
+    void (*sem_post)(ct_sem_t *sem);
+
+    //! Wait until semaphore is positive and decrement it
+    //! \param sem Semaphore
+    void (*sem_wait)(ct_sem_t *sem);
+
+    //! Pin actual thread to cpus
+    //! \param cpus Cpu index array
+    //! \param cpu_count Cpu count
+    //! \return True if platform support affinity and call succeed
+    bool (*set_affinity)(const uint32_t *cpus,
+                         uint32_t cpu_count);
 };
 
 
@@ -2,7 +2,11 @@
 #include <string.h>
 #include <stdatomic.h>
 
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <corelib/macros.h>
 #include <corelib/api_system.h>
@@ -14,77 +18,314 @@
 #include <corelib/hash.inl>
 #include <corelib/os.h>
 
+#if CT_PLATFORM_LINUX
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
 
 #define _G coredb_global
 #define LOG_WHERE "coredb"
 
-#define MAX_OBJECTS 1000000000ULL
-#define MAX_FREE_OBJECT_POOL 10000
-#define MAX_FREE_OBJECT_ID_POOL 10000
+#define MAX_OBJECTS (1ULL << 28)
+#define MAX_FREE_WRITERS 64
+#define MAX_SHAPE_PROPERTIES 64
+#define MAGAZINE_SIZE 64
+#define EPOCH_RECLAIM_PERIOD 64
+#define EPOCH_RECLAIM_BUDGET 16384
+
+#define TABLE_PAGE_SHIFT 12
+#define TABLE_PAGE_SIZE (1u << TABLE_PAGE_SHIFT)
+#define TABLE_PAGE_MASK (TABLE_PAGE_SIZE - 1)
+#define TABLE_MAX_PAGES (MAX_OBJECTS >> TABLE_PAGE_SHIFT)
+#define TABLE_PAGE_RELEASING 0x80000000u
+
+#define STR_MIN_BUCKETS 256
 
 // TODO: non optimal braindump code
 // TODO: remove null element
 
 struct notify_pair {
     ct_cdb_notify notify;
+    ct_cdb_notify_batch notify_batch;
     void *data;
 };
 
+// Changed properties of object, each key once.
+struct notify_change_t {
+    uint64_t obj;
+    uint64_t *prop;
+};
+
+// Changes merged by object, obj => index in changes.
+struct notify_changes_t {
+    struct notify_change_t *changes;
+    struct ct_hash_t obj_map;
+};
+
+// Keys, types and offsets of object properties.
+// Layout is shared between versions of object until property is added.
+//
+// Shape is layout shared by all objects with same properties added in same
+// order. Shapes form tree from empty root shape, adding property follow
+// transition to child shape. Shapes are immutable and live until shutdown.
+// Object with more than MAX_SHAPE_PROPERTIES get own mutable layout.
+//
+// Frozen layout is created by load. Keys are sorted and searched without
+// prop_map, arrays and values of loaded version are in loaded image (or in
+// same allocation as layout for resolved view). Frozen layout is never
+// changed, adding property make mutable copy.
+struct object_layout_t {
+    atomic_uint refcount;
+    bool frozen;
+    bool shape;
+
+    // shape only, key => child shape
+    struct ct_hash_t transitions;
+
+    struct ct_hash_t prop_map;
+
+    uint64_t properties_count;
+    uint64_t values_size;
+
+    uint64_t *keys;
+    uint8_t *property_type;
+    uint64_t *offset;
+};
+
+// Header of refcounted str or blob, data follow at RC_DATA_OFFSET.
+// Str is interned, same string is stored once. Blob is immutable.
+// Object own one reference of each str and blob value, versions of object
+// share it. Replaced value is released with old version.
+struct rc_data_t {
+    atomic_uint refcount;
+    uint32_t type;
+    uint64_t size;
+
+    // str only
+    uint64_t hash;
+    struct rc_data_t *next;
+};
+
+#define RC_DATA_OFFSET ((sizeof(struct rc_data_t) + 15) & ~15ULL)
+
+// Buffer given to load or mapped checkpoint file. Objects loaded frozen
+// use its tables, values, strings and blobs in place. Freed when last
+// object release it.
+struct image_t {
+    atomic_uint refcount;
+    char *data;
+    uint64_t size;
+    struct ct_alloc *allocator;
+    bool mapped;
+};
+
+// Instances of prefab. Array grow by copy and old one is retired, so
+// readers iterate it without lock while other thread add instance.
+struct instances_t {
+    atomic_uint n;
+    uint32_t capacity;
+    atomic_ullong objid[];
+};
+
+// Object id is address of this item. Data shared by all versions of
+// object live here.
+struct object_id_t {
+    atomic_ullong version;
+    _Atomic(struct instances_t *) instances;
+};
+
 struct object_t {
     struct notify_pair *notify;
 
     // prefab
     uint64_t prefab;
-    uint64_t *instances;
 
     // hiearchy
     uint64_t parent;
 //    uint64_t *children;
 
-    // writer
-    uint64_t orig_data_idx;
-    uint64_t obj;
-    uint64_t *changed_prop;
-
     // object
     uint64_t type;
     uint64_t idx;
     struct ct_cdb_t db;
-    struct ct_hash_t prop_map;
 
-    uint64_t properties_count;
+    // index in id table
+    uint32_t id;
 
-    uint64_t *keys;
-    uint8_t *property_type;
-    uint64_t *offset;
+    struct object_layout_t *layout;
+    uint8_t *values;
+
+    // values are in frozen layout allocation
+    bool frozen;
+
+    // loaded image that values and str/blob data can point into
+    struct image_t *image;
+
+    // replaced str/blob data, free with this version
+    void **garbage;
+
+    // Frozen layout with own and inherited properties of this version,
+    // built on first read through instance. Only for object with prefab.
+    _Atomic(struct object_layout_t *) resolved;
+    atomic_uint resolved_gen;
+};
+
+// Property changed by writer, value is in writer values.
+struct writer_prop_t {
+    uint64_t key;
+    uint64_t offset;
+    uint64_t size;
+    uint8_t type;
+};
+
+// Writer record only changed properties and apply them on commit.
+struct writer_t {
+    struct writer_t *next;
+
+    uint64_t obj;
+    uint64_t orig_version;
+    uint64_t parent;
+
+    struct ct_hash_t prop_map;
+    struct writer_prop_t *props;
     uint8_t *values;
+
+    uint64_t *changed_prop;
+    void **garbage;
+};
+
+// Table page is header with free list links followed by items.
+struct table_page_t {
+    // allocated items, TABLE_PAGE_RELEASING while gc release items
+    atomic_uint live;
+
+    // items are zero since last release
+    atomic_bool released;
+
+    atomic_uint next[TABLE_PAGE_SIZE];
+    atomic_uint next_chain[TABLE_PAGE_SIZE];
+};
+
+// Items start on OS page so they can be released without links.
+#define TABLE_ITEMS_OFFSET ((sizeof(struct table_page_t) + 4095) & ~4095ULL)
+
+// Growable table of fixed size items addressed by index.
+// Pages are mapped on first use and never move, so item pointers are
+// stable. Page without live items is released in gc.
+//
+// Free items are in lock-free stack of index chains, index 0 is null.
+// Chain has up to MAGAZINE_SIZE indices linked by next and is taken whole
+// to thread magazine. Head is tag << 32 | first index of chain.
+struct table_t {
+    _Atomic(struct table_page_t *) *pages;
+    uint64_t item_size;
+
+    atomic_ullong used;
+    atomic_ullong head;
+};
+
+// Per thread cache of free indices, refill and flush whole chain.
+struct magazine_t {
+    uint32_t db;
+    uint32_t objects_n;
+    uint32_t ids_n;
+    uint32_t objects[MAGAZINE_SIZE];
+    uint32_t ids[MAGAZINE_SIZE];
+};
+
+// Position of object id in one set of index.
+struct index_entry_t {
+    uint32_t set;
+    uint32_t pos;
+};
+
+// Objects of type with property value, dense array of object id.
+struct value_bucket_t {
+    uint64_t value;
+    uint32_t *ids;
+};
+
+struct value_index_t {
+    uint64_t prop;
+    struct ct_hash_t bucket_map;
+    struct value_bucket_t *buckets;
+    struct index_entry_t *entries;
+};
+
+// Objects of type, dense array of object id.
+struct type_index_t {
+    uint64_t type;
+    uint32_t *ids;
+    struct value_index_t *value_index;
+};
+
+// Entries of object are linked by number, 0 is none.
+struct changelog_entry_t {
+    struct ct_cdb_prop_change_t change;
+    uint64_t prev;
 };
 
 struct db_t {
     uint32_t idx;
 
-    // id pool
-    uint64_t *objects_mem;
-    atomic_ullong object_used;
+    // id => version idx, object id is address of item
+    struct table_t ids;
 
-    uint32_t *free_objects_id;
+    struct ct_spinlock destroy_lock;
     uint32_t *to_free_objects_id;
-    atomic_ullong to_free_objects_id_n;
-    atomic_ullong free_objects_id_n;
 
 //    // Hiearchy
 //    uint32_t *first_child;
 //    uint32_t *next_sibling;
 //    uint32_t *parent;
 
-    // objects
-    struct object_t *object_pool;
-    uint32_t *free_objects;
-    uint32_t *to_free_objects;
+    // object versions
+    struct table_t objects;
+
+    // type => objects, entries by object id
+    struct ct_spinlock index_lock;
+    struct ct_hash_t type_map;
+    struct type_index_t *type_index;
+    struct index_entry_t *index_entries;
+    atomic_uint value_index_n;
+
+    // property changes of commits, first entry is number changelog_first
+    // + 1, obj => number of last entry of object
+    atomic_bool changelog_enabled;
+    struct ct_spinlock changelog_lock;
+    atomic_ullong changelog_epoch;
+    struct changelog_entry_t *changelog;
+    uint64_t changelog_first;
+    struct ct_hash_t changelog_last;
+};
+
+enum retired_type {
+    RETIRED_OBJECT = 0,
+    RETIRED_OBJECT_ID,
+    RETIRED_PTR,
+};
+
+// Object version, object id or allocation unreachable since epoch.
+struct retired_t {
+    uint64_t epoch;
+    uint64_t data;
+    uint32_t db;
+    uint32_t type;
+};
 
-    atomic_ullong object_pool_n;
-    atomic_ullong free_objects_n;
-    atomic_ullong to_free_objects_n;
+// Thread state for epoch-based reclamation.
+// Epoch is global epoch << 1 | 1 while thread read objects, 0 otherwise.
+// Retired items are freed when global epoch is two ahead of them, no
+// thread can hold reference then.
+struct epoch_thread_t {
+    struct epoch_thread_t *next;
+    atomic_ullong epoch;
+    uint32_t nesting;
+
+    // owner retire, owner and gc reclaim
+    struct ct_spinlock lock;
+    struct retired_t *retired;
+    uint32_t retired_head;
 };
 
 static struct _G {
@@ -92,6 +333,27 @@ static struct _G {
     uint32_t *free_db;
     uint32_t *to_free_db;
 
+    struct object_layout_t *root_shape;
+    struct ct_spinlock shape_lock;
+
+    atomic_ullong epoch;
+    _Atomic(struct epoch_thread_t *) epoch_threads;
+    bool heavy_barrier;
+
+    // add and remove of prefab instances
+    struct ct_spinlock instances_lock;
+
+    // interned strings, chains by hash
+    struct ct_spinlock str_lock;
+    struct rc_data_t **str_buckets;
+    uint64_t str_buckets_n;
+    uint64_t str_n;
+
+    // commited changes waiting for flush_notify
+    atomic_bool notify_deferred;
+    struct ct_spinlock notify_lock;
+    struct notify_changes_t notify_queue;
+
     struct ct_alloc *allocator;
     struct ct_cdb_t global_db;
 } _G;
@@ -117,702 +379,3369 @@ union type_u {
     struct blob_t blob;
 };
 
-static struct object_t *_get_object_from_objid(uint64_t objid) {
-    uint64_t idx = *(uint64_t *) objid;
+static const uint64_t _type_size[] = {
+        [CDB_TYPE_NONE] = 0,
+        [CDB_TYPE_UINT64] = sizeof(uint64_t),
+        [CDB_TYPE_PTR] = sizeof(void *),
+        [CDB_TYPE_REF] = sizeof(uint64_t),
+        [CDB_TYPE_FLOAT] = sizeof(float),
+        [CDB_TYPE_BOOL] = sizeof(bool),
+        [CDB_TYPE_STR] = sizeof(char *),
+        [CDB_TYPE_VEC3] = sizeof(float) * 3,
+        [CDB_TYPE_VEC4] = sizeof(float) * 4,
+        [CDB_TYPE_MAT4] = sizeof(float) * 16,
+        [CDB_TYPE_SUBOBJECT] = sizeof(uint64_t),
+        [CDB_TYPE_BLOB] = sizeof(struct blob_t),
+};
 
-    return &_G.dbs[0].object_pool[idx];
+static struct table_page_t *_table_page(const struct table_t *table,
+                                        uint32_t idx) {
+    return atomic_load_explicit(&table->pages[idx >> TABLE_PAGE_SHIFT],
+                                memory_order_acquire);
 }
 
-static struct object_t *_get_object_from_obj_o(ct_cdb_obj_o *obj_o) {
-    uint64_t idx = (uint64_t) obj_o;
+static void *_table_item(const struct table_t *table,
+                         uint32_t idx) {
+    uint8_t *page = (uint8_t *) _table_page(table, idx);
 
-    return &_G.dbs[0].object_pool[idx];
+    return page + TABLE_ITEMS_OFFSET + ((idx & TABLE_PAGE_MASK) *
+                                        table->item_size);
 }
 
-static uint64_t _object_new_property(struct object_t *obj,
-                                     uint64_t key,
-                                     enum ct_cdb_type type,
-                                     const void *value,
-                                     size_t size,
-                                     const struct ct_alloc *alloc) {
+static atomic_uint *_table_next(const struct table_t *table,
+                                uint32_t idx) {
+    return &_table_page(table, idx)->next[idx & TABLE_PAGE_MASK];
+}
 
-    const uint64_t prop_count = obj->properties_count;
-    const uint64_t values_size = ct_array_size(obj->values);
+static atomic_uint *_table_next_chain(const struct table_t *table,
+                                      uint32_t idx) {
+    return &_table_page(table, idx)->next_chain[idx & TABLE_PAGE_MASK];
+}
 
-    ct_array_push(obj->keys, key, alloc);
-    ct_array_push(obj->property_type, type, alloc);
-    ct_array_push(obj->offset, values_size, alloc);
+static struct object_t *_get_object_from_version(uint64_t version) {
+    return _table_item(&_G.dbs[0].objects, version);
+}
 
-    if (size) {
-        ct_array_resize(obj->values, values_size + size, alloc);
-    }
+// Objid is aligned address and ct_hash take key modulo size, ids from
+// one table page would fill few long probe runs. Mix bits first.
+static uint64_t _objid_key(uint64_t objid) {
+    uint64_t k = objid;
 
-    ct_hash_add(&obj->prop_map, key, prop_count, alloc);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
 
-    obj->properties_count = obj->properties_count + 1;
-    return prop_count;
+    return k;
 }
 
-struct object_t *_new_object(struct db_t *db,
-                             const struct ct_alloc *a) {
+static struct object_t *_get_object_from_objid(uint64_t objid) {
+    // Pair with commit CAS, version is complete before it is visible.
+    uint64_t idx = atomic_load_explicit((atomic_ullong *) objid,
+                                        memory_order_acquire);
 
-    uint32_t idx;
-    if (db->free_objects_n) {
-        atomic_fetch_sub(&db->free_objects_n, 1);
-        idx = db->free_objects[db->free_objects_n];
-    } else {
-        idx = atomic_fetch_add(&db->object_pool_n, 1);
+    return _get_object_from_version(idx);
+}
 
-        db->object_pool[idx] = (struct object_t) {0};
-    }
+static struct writer_t *_get_writer_from_obj_o(ct_cdb_obj_o *obj_o) {
+    return (struct writer_t *) obj_o;
+}
+
+static uint64_t _layout_new_property(struct object_layout_t *layout,
+                                     uint64_t key,
+                                     enum ct_cdb_type type,
+                                     uint64_t offset,
+                                     const struct ct_alloc *alloc) {
+    const uint64_t prop_count = layout->properties_count;
 
+    ct_array_push(layout->keys, key, alloc);
+    ct_array_push(layout->property_type, type, alloc);
+    ct_array_push(layout->offset, offset, alloc);
 
-    struct object_t *obj = &db->object_pool[idx];
-    obj->idx = idx;
-    obj->db.idx = db->idx;
+    ct_hash_add(&layout->prop_map, key, prop_count, alloc);
 
-    _object_new_property(obj, 0, CDB_TYPE_NONE, NULL, 0, a);
-    return obj;
+    layout->properties_count = layout->properties_count + 1;
+    return prop_count;
 }
 
-static uint64_t _new_object_id(struct db_t *db_inst) {
-    uint64_t idx = 0;
-    if (db_inst->free_objects_id_n) {
-        atomic_fetch_sub(&db_inst->free_objects_id_n, 1);
-        idx = db_inst->free_objects_id[db_inst->free_objects_id_n];
-    } else {
-        idx = atomic_fetch_add(&db_inst->object_used, 1);
-    }
+static struct object_layout_t *_new_layout(const struct ct_alloc *alloc) {
+    struct object_layout_t *layout = CT_ALLOC(alloc, struct object_layout_t,
+                                              sizeof(struct object_layout_t));
 
-    return idx;
+    *layout = (struct object_layout_t) {0};
+    atomic_init(&layout->refcount, 1);
+
+    // null property
+    _layout_new_property(layout, 0, CDB_TYPE_NONE, 0, alloc);
+
+    return layout;
 }
 
-static struct object_t *_object_clone(struct db_t *db,
-                                      struct object_t *obj,
-                                      const struct ct_alloc *alloc) {
-    const uint64_t properties_count = obj->properties_count;
-    const uint64_t values_size = ct_array_size(obj->values);
+static struct object_layout_t *_layout_clone(struct object_layout_t *layout,
+                                             const struct ct_alloc *alloc) {
+    const size_t size = sizeof(struct object_layout_t);
+    struct object_layout_t *new_layout = CT_ALLOC(alloc,
+                                                  struct object_layout_t,
+                                                  size);
 
-    struct object_t *new_obj = _new_object(db, alloc);
+    const uint64_t properties_count = layout->properties_count;
 
-    new_obj->prefab = obj->prefab;
-    new_obj->parent = obj->parent;
+    *new_layout = (struct object_layout_t) {
+            .properties_count = properties_count,
+            .values_size = layout->values_size,
+    };
 
-    new_obj->type = obj->type;
-    new_obj->properties_count = properties_count;
+    atomic_init(&new_layout->refcount, 1);
 
-    ct_array_push_n(new_obj->keys, obj->keys + 1,
-                    ct_array_size(obj->keys) - 1, alloc);
+    ct_array_push_n(new_layout->keys, layout->keys,
+                    properties_count, alloc);
 
-    ct_array_push_n(new_obj->property_type, obj->property_type + 1,
-                    ct_array_size(obj->property_type) - 1, alloc);
+    ct_array_push_n(new_layout->property_type, layout->property_type,
+                    properties_count, alloc);
 
-    ct_array_push_n(new_obj->offset, obj->offset + 1,
-                    ct_array_size(obj->offset) - 1, alloc);
+    ct_array_push_n(new_layout->offset, layout->offset,
+                    properties_count, alloc);
 
-    if (values_size)
-        ct_array_push_n(new_obj->values, obj->values, values_size, alloc);
+    if (layout->frozen) {
+        for (int i = 1; i < properties_count; ++i) {
+            ct_hash_add(&new_layout->prop_map, layout->keys[i], i, alloc);
+        }
+    } else {
+        ct_hash_clone(&layout->prop_map, &new_layout->prop_map, alloc);
+    }
+
+    return new_layout;
+}
 
+static void _layout_retain(struct object_layout_t *layout) {
+    if (layout->shape) {
+        return;
+    }
 
-    ct_hash_clone(&obj->prop_map, &new_obj->prop_map, alloc);
+    atomic_fetch_add(&layout->refcount, 1);
+}
 
-    uint32_t n = ct_array_size(obj->instances);
-    if (n) {
-        ct_array_push_n(new_obj->instances, obj->instances, n, alloc);
+static void _layout_release(struct object_layout_t *layout,
+                            const struct ct_alloc *alloc) {
+    if (layout->shape) {
+        return;
     }
 
-//    n = ct_array_size(obj->children);
-//    if (n) {
-//        ct_array_push_n(new_obj->children, obj->children, n, alloc);
-//    }
+    if (atomic_fetch_sub(&layout->refcount, 1) != 1) {
+        return;
+    }
 
-    n = ct_array_size(obj->notify);
-    if (n) {
-        ct_array_push_n(new_obj->notify, obj->notify, n, alloc);
+    if (layout->frozen) {
+        CT_FREE(alloc, layout);
+        return;
     }
 
-    return new_obj;
-}
+    ct_array_free(layout->keys, alloc);
+    ct_array_free(layout->property_type, alloc);
+    ct_array_free(layout->offset, alloc);
+    ct_hash_free(&layout->prop_map, alloc);
 
-static uint64_t _find_prop_index(const struct object_t *obj,
-                                 uint64_t key) {
-    return ct_hash_lookup(&obj->prop_map, key, 0);
+    CT_FREE(alloc, layout);
 }
 
-static void _destroy_object(struct object_t *obj) {
-    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+// Layout can be changed only if no other version use it.
+static void _object_make_mutable(struct object_t *obj,
+                                 const struct ct_alloc *alloc) {
+    if (obj->frozen) {
+        uint8_t *values = NULL;
+        ct_array_push_n(values, obj->values, obj->layout->values_size, alloc);
 
-    uint64_t idx = atomic_fetch_add(&db_inst->to_free_objects_n, 1);
-    db_inst->to_free_objects[idx] = obj->idx;
-}
+        obj->values = values;
+        obj->frozen = false;
+    }
 
-static struct ct_cdb_t create_db() {
-    uint64_t idx = ct_array_size(_G.dbs);
+    struct object_layout_t *old_layout = obj->layout;
 
-    struct db_t db = (struct db_t) {
-            .idx = idx,
+    if (!old_layout->frozen && !old_layout->shape &&
+        (atomic_load(&old_layout->refcount) == 1)) {
+        return;
+    }
 
-            .objects_mem = (uint64_t *) mmap(NULL,
-                                             MAX_OBJECTS * sizeof(uint64_t),
-                                             PROT_READ | PROT_WRITE,
-                                             MAP_PRIVATE | MAP_ANONYMOUS,
-                                             -1, 0),
-
-
-            .free_objects_id = (uint32_t *) mmap(NULL,
-                                                 MAX_OBJECTS * sizeof(uint32_t),
-                                                 PROT_READ | PROT_WRITE,
-                                                 MAP_PRIVATE | MAP_ANONYMOUS,
-                                                 -1, 0),
-
-            .to_free_objects_id = (uint32_t *) mmap(NULL,
-                                                    MAX_OBJECTS *
-                                                    sizeof(uint32_t),
-                                                    PROT_READ | PROT_WRITE,
-                                                    MAP_PRIVATE | MAP_ANONYMOUS,
-                                                    -1, 0),
-            .object_pool = (struct object_t *) mmap(NULL,
-                                                    MAX_OBJECTS *
-                                                    sizeof(struct object_t),
-                                                    PROT_READ | PROT_WRITE,
-                                                    MAP_PRIVATE | MAP_ANONYMOUS,
-                                                    -1, 0),
-            .free_objects = (uint32_t *) mmap(NULL,
-                                              MAX_OBJECTS * sizeof(uint32_t),
-                                              PROT_READ | PROT_WRITE,
-                                              MAP_PRIVATE | MAP_ANONYMOUS,
-                                              -1, 0),
-
-            .to_free_objects = (uint32_t *) mmap(NULL,
-                                                 MAX_OBJECTS * sizeof(uint32_t),
-                                                 PROT_READ | PROT_WRITE,
-                                                 MAP_PRIVATE | MAP_ANONYMOUS,
-                                                 -1, 0)
-    };
+    obj->layout = _layout_clone(old_layout, alloc);
+    _layout_release(old_layout, alloc);
+}
 
-    ct_array_push(_G.dbs, db, _G.allocator);
-    return (struct ct_cdb_t) {.idx = idx};
-};
+// Return child shape with added property, NULL if key has other type.
+static struct object_layout_t *_shape_transition(struct object_layout_t *shape,
+                                                 uint64_t key,
+                                                 enum ct_cdb_type type,
+                                                 size_t size) {
+    ct_os_a0->thread->spin_lock(&_G.shape_lock);
 
-static uint64_t create_object(struct ct_cdb_t db,
-                              uint64_t type) {
-    struct db_t *db_inst = &_G.dbs[db.idx];
-    struct object_t *obj = _new_object(db_inst, _G.allocator);
+    struct object_layout_t *child = (struct object_layout_t *) \
+            ct_hash_lookup(&shape->transitions, key, 0);
 
-    uint64_t idx = _new_object_id(db_inst);
+    if (!child) {
+        child = _layout_clone(shape, _G.allocator);
+        child->shape = true;
 
-    uint64_t *obj_addr = db_inst->objects_mem + idx;
+        _layout_new_property(child, key, type, shape->values_size,
+                             _G.allocator);
+        child->values_size += size;
 
-    *obj_addr = obj->idx;
-    obj->db = db;
-    obj->type = type;
+        ct_hash_add(&shape->transitions, key, (uint64_t) child,
+                    _G.allocator);
+    } else if (child->property_type[shape->properties_count] != type) {
+        child = NULL;
+    }
 
-    return (uint64_t) obj_addr;
+    ct_os_a0->thread->spin_unlock(&_G.shape_lock);
+
+    return child;
 }
 
-static ct_cdb_obj_o *write_begin(uint64_t _obj);
+static uint8_t *_frozen_values(const struct object_layout_t *layout) {
+    const uint64_t types_size = (layout->properties_count + 7) & ~7ULL;
+    return layout->property_type + types_size;
+}
 
-static void write_commit(ct_cdb_obj_o *_writer);
+// Frozen layout with properties and values in one allocation.
+// Caller fill properties from index 1 and sort them.
+static struct object_layout_t *_frozen_layout_alloc(uint64_t properties_count,
+                                                    uint64_t values_size,
+                                                    const struct ct_alloc *a) {
+    const uint64_t n = properties_count + 1;
+    const uint64_t types_size = (n + 7) & ~7ULL;
+
+    const size_t size = sizeof(struct object_layout_t) +
+                        (sizeof(uint64_t) * n * 2) +
+                        types_size +
+                        values_size;
+
+    struct object_layout_t *layout = CT_ALLOC(a, struct object_layout_t,
+                                              size);
+
+    *layout = (struct object_layout_t) {
+            .frozen = true,
+            .properties_count = n,
+            .values_size = values_size,
+    };
 
-void set_subobject(ct_cdb_obj_o *_writer,
-                   uint64_t property,
-                   uint64_t subobject);
+    atomic_init(&layout->refcount, 1);
 
-static uint64_t create_from(struct ct_cdb_t db,
-                            uint64_t _obj) {
-    struct db_t *db_inst = &_G.dbs[db.idx];
+    layout->keys = (uint64_t *) (layout + 1);
+    layout->offset = layout->keys + n;
+    layout->property_type = (uint8_t *) (layout->offset + n);
 
-    struct object_t *obj = _get_object_from_objid(_obj);
+    layout->keys[0] = 0;
+    layout->offset[0] = 0;
+    layout->property_type[0] = CDB_TYPE_NONE;
 
-    struct object_t *inst = _new_object(db_inst, _G.allocator);
-    inst->db = db;
+    return layout;
+}
 
-    uint64_t idx = _new_object_id(db_inst);
+// Insertion sort by key, dumped frozen objects are already sorted.
+static void _frozen_layout_sort(struct object_layout_t *layout) {
+    uint64_t *keys = layout->keys;
+    uint64_t *offset = layout->offset;
+    uint8_t *types = layout->property_type;
+
+    for (uint64_t i = 2; i < layout->properties_count; ++i) {
+        const uint64_t key = keys[i];
+        const uint64_t off = offset[i];
+        const uint8_t type = types[i];
+
+        uint64_t j = i;
+        while ((j > 1) && (keys[j - 1] > key)) {
+            keys[j] = keys[j - 1];
+            offset[j] = offset[j - 1];
+            types[j] = types[j - 1];
+            --j;
+        }
 
-    uint64_t *obj_addr = db_inst->objects_mem + idx;
+        keys[j] = key;
+        offset[j] = off;
+        types[j] = type;
+    }
+}
 
-    *obj_addr = inst->idx;
+static void _image_retain(struct image_t *image) {
+    atomic_fetch_add(&image->refcount, 1);
+}
 
-    inst->prefab = _obj;
-    inst->type = obj->type;
+static void _image_release(struct image_t *image) {
+    if (!image || (atomic_fetch_sub(&image->refcount, 1) != 1)) {
+        return;
+    }
 
-    ct_array_push(obj->instances, (uint64_t) obj_addr, _G.allocator);
+    if (image->mapped) {
+        munmap(image->data, image->size);
+    } else {
+        CT_FREE(image->allocator, image->data);
+    }
 
-    uint32_t n = ct_array_size(obj->notify);
-    if (n) {
-        ct_array_push_n(inst->notify, obj->notify, n, _G.allocator);
+    CT_FREE(_G.allocator, image);
+}
+
+// Data in image is not owned by object and must not be freed.
+static bool _image_contains(const struct image_t *image,
+                            const void *ptr) {
+    if (!image) {
+        return false;
     }
 
-    struct object_t *wr = write_begin((uint64_t) obj_addr);
+    const char *p = ptr;
+    return (p >= image->data) && (p < (image->data + image->size));
+}
 
-    for (int i = 1; i < obj->properties_count; ++i) {
-        switch (obj->property_type[i]) {
-            case CDB_TYPE_SUBOBJECT: {
-                union type_u *value_ptr = (union type_u *) (obj->values +
-                                                            obj->offset[i]);
+static struct rc_data_t *_rc_header(const void *data) {
+    return (struct rc_data_t *) (((char *) data) - RC_DATA_OFFSET);
+}
 
-                uint64_t old_subobj = value_ptr->subobj;
+static char *_rc_data(struct rc_data_t *rc) {
+    return ((char *) rc) + RC_DATA_OFFSET;
+}
 
-                uint64_t new_subobj = create_from(db, old_subobj);
+static void _str_rehash(uint64_t buckets_n) {
+    struct rc_data_t **buckets = CT_ALLOC(_G.allocator, struct rc_data_t *,
+                                          sizeof(struct rc_data_t *) *
+                                          buckets_n);
 
-                set_subobject(wr, obj->keys[i], new_subobj);
-            }
+    memset(buckets, 0, sizeof(struct rc_data_t *) * buckets_n);
 
-                break;
+    for (uint64_t i = 0; i < _G.str_buckets_n; ++i) {
+        struct rc_data_t *rc = _G.str_buckets[i];
 
-            default:
-                break;
+        while (rc) {
+            struct rc_data_t *next = rc->next;
+            struct rc_data_t **bucket = &buckets[rc->hash & (buckets_n - 1)];
+
+            rc->next = *bucket;
+            *bucket = rc;
+
+            rc = next;
         }
     }
 
-    write_commit(wr);
+    if (_G.str_buckets) {
+        CT_FREE(_G.allocator, _G.str_buckets);
+    }
 
-    return (uint64_t) obj_addr;
+    _G.str_buckets = buckets;
+    _G.str_buckets_n = buckets_n;
 }
 
-static void destroy_db(struct ct_cdb_t db) {
-    ct_array_push(_G.to_free_db, db.idx, _G.allocator);
-}
+// Return referenced interned copy of str.
+static char *_str_intern(const char *str) {
+    const uint64_t size = strlen(str) + 1;
+    const uint64_t hash = ct_hash_murmur2_64(str, size, 0);
 
-static void destroy_object(uint64_t _obj) {
+    ct_os_a0->thread->spin_lock(&_G.str_lock);
 
-    struct object_t *obj = _get_object_from_objid(_obj);
-    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+    if (_G.str_n >= _G.str_buckets_n) {
+        _str_rehash(_G.str_buckets_n ? _G.str_buckets_n * 2
+                                     : STR_MIN_BUCKETS);
+    }
 
-    uint64_t idx = atomic_fetch_add(&db_inst->to_free_objects_id_n, 1);
+    struct rc_data_t **bucket = &_G.str_buckets[hash &
+                                                (_G.str_buckets_n - 1)];
 
-    db_inst->to_free_objects_id[idx] = \
-            ((uint64_t *) _obj) - db_inst->objects_mem;
+    struct rc_data_t *rc = *bucket;
+    while (rc && ((rc->hash != hash) || (rc->size != size) ||
+                  memcmp(_rc_data(rc), str, size))) {
+        rc = rc->next;
+    }
 
-    for (int i = 1; i < obj->properties_count; ++i) {
-        switch (obj->property_type[i]) {
-            case CDB_TYPE_SUBOBJECT: {
-                union type_u *value_ptr = (union type_u *) (obj->values +
-                                                            obj->offset[i]);
+    if (rc) {
+        atomic_fetch_add(&rc->refcount, 1);
+    } else {
+        rc = CT_ALLOC(_G.allocator, struct rc_data_t,
+                      RC_DATA_OFFSET + size);
 
-                uint64_t old_subobj = value_ptr->subobj;
-                destroy_object(old_subobj);
-            }
+        *rc = (struct rc_data_t) {
+                .type = CDB_TYPE_STR,
+                .size = size,
+                .hash = hash,
+                .next = *bucket,
+        };
 
-                break;
+        atomic_init(&rc->refcount, 1);
+        memcpy(_rc_data(rc), str, size);
 
-            default:
-                break;
-        }
+        *bucket = rc;
+        ++_G.str_n;
     }
 
+    ct_os_a0->thread->spin_unlock(&_G.str_lock);
+
+    return _rc_data(rc);
 }
 
+static void *_blob_new(const void *data,
+                       uint64_t size) {
+    struct rc_data_t *rc = CT_ALLOC(_G.allocator, struct rc_data_t,
+                                    RC_DATA_OFFSET + size);
 
-static void gc() {
-    const uint32_t db_n = ct_array_size(_G.dbs);
-    for (int i = 0; i < db_n; ++i) {
-        struct db_t *db_inst = &_G.dbs[i];
+    *rc = (struct rc_data_t) {
+            .type = CDB_TYPE_BLOB,
+            .size = size,
+    };
 
-        const uint32_t to_free_objects_id_n = db_inst->to_free_objects_id_n;
+    atomic_init(&rc->refcount, 1);
 
-        for (int j = 0; j < to_free_objects_id_n; ++j) {
-            const uint32_t idx = db_inst->to_free_objects_id[j];
+    if (size) {
+        memcpy(_rc_data(rc), data, size);
+    }
 
-            uint64_t *obj_addr = db_inst->objects_mem + idx;
-            struct object_t *obj = _get_object_from_objid((uint64_t) obj_addr);
+    return _rc_data(rc);
+}
 
-            if (obj->prefab) {
-                struct object_t *prefab_obj = \
-                    _get_object_from_objid(obj->prefab);
+static void _rc_retain(void *data) {
+    atomic_fetch_add(&_rc_header(data)->refcount, 1);
+}
 
-                const uint32_t instances_n = \
-                    ct_array_size(prefab_obj->instances);
+static void _str_free(struct rc_data_t *rc) {
+    struct rc_data_t **it = &_G.str_buckets[rc->hash &
+                                            (_G.str_buckets_n - 1)];
 
-                const uint32_t last_idx = instances_n - 1;
-                for (int k = 0; k < instances_n; ++k) {
-                    if (prefab_obj->instances[k] != obj->obj) {
-                        continue;
-                    }
+    while (*it != rc) {
+        it = &(*it)->next;
+    }
 
-                    prefab_obj->instances[k] = prefab_obj->instances[last_idx];
-                    ct_array_pop_back(prefab_obj->instances);
+    *it = rc->next;
+    --_G.str_n;
 
-                    break;
-                }
-            }
+    CT_FREE(_G.allocator, rc);
+}
 
-            _destroy_object(obj);
+static void _rc_release(void *data) {
+    struct rc_data_t *rc = _rc_header(data);
 
-            db_inst->free_objects_id[atomic_fetch_add(&db_inst->free_objects_id_n, 1)] = idx;
+    if (rc->type == CDB_TYPE_BLOB) {
+        if (atomic_fetch_sub(&rc->refcount, 1) == 1) {
+            CT_FREE(_G.allocator, rc);
         }
 
-        db_inst->to_free_objects_id_n = 0;
+        return;
+    }
 
-        const uint32_t to_free_objects_n = db_inst->to_free_objects_n;
-        for (int j = 0; j < to_free_objects_n; ++j) {
-            const uint32_t idx = db_inst->to_free_objects[j];
+    // Last reference of str is dropped under lock so intern can't find
+    // str that is being freed.
+    uint32_t refcount = atomic_load(&rc->refcount);
+    while (refcount > 1) {
+        if (atomic_compare_exchange_weak(&rc->refcount, &refcount,
+                                         refcount - 1)) {
+            return;
+        }
+    }
 
-            struct object_t *obj = &db_inst->object_pool[idx];
+    ct_os_a0->thread->spin_lock(&_G.str_lock);
 
-//            ct_array_clean(obj->children);
-            ct_array_clean(obj->instances);
+    if (atomic_fetch_sub(&rc->refcount, 1) == 1) {
+        _str_free(rc);
+    }
 
-            ct_array_clean(obj->property_type);
-            ct_array_clean(obj->keys);
-            ct_array_clean(obj->values);
-            ct_array_clean(obj->offset);
+    ct_os_a0->thread->spin_unlock(&_G.str_lock);
+}
 
-            ct_hash_clean(&obj->prop_map);
+// Frozen layout that use keys, offsets, types and values stored in
+// dumped order at tables.
+static struct object_layout_t *_frozen_layout_map(uint8_t *tables,
+                                                  uint64_t properties_count,
+                                                  uint64_t values_size,
+                                                  const struct ct_alloc *a) {
+    const uint64_t n = properties_count + 1;
+
+    struct object_layout_t *layout = CT_ALLOC(a, struct object_layout_t,
+                                              sizeof(struct object_layout_t));
+
+    *layout = (struct object_layout_t) {
+            .frozen = true,
+            .properties_count = n,
+            .values_size = values_size,
+    };
 
-            ct_array_clean(obj->changed_prop);
-            ct_array_clean(obj->notify);
+    atomic_init(&layout->refcount, 1);
 
-            *obj = (struct object_t) {
-//                    .children = obj->children,
-                    .instances = obj->instances,
-                    .property_type = obj->property_type,
-                    .keys = obj->keys,
-                    .values = obj->values,
-                    .offset = obj->offset,
-                    .prop_map = obj->prop_map,
-                    .changed_prop = obj->changed_prop,
-                    .notify = obj->notify,
-            };
+    layout->keys = (uint64_t *) tables;
+    layout->offset = layout->keys + n;
+    layout->property_type = (uint8_t *) (layout->offset + n);
 
-            db_inst->free_objects[atomic_fetch_add(&db_inst->free_objects_n, 1)] = idx;
-        }
+    return layout;
+}
 
-        db_inst->to_free_objects_n = 0;
+// Replace empty layout of object with frozen layout in loaded image.
+static void _object_freeze(struct object_t *obj,
+                           struct image_t *image,
+                           uint8_t *tables,
+                           uint64_t properties_count,
+                           uint64_t values_size,
+                           const struct ct_alloc *alloc) {
+    struct object_layout_t *layout = _frozen_layout_map(tables,
+                                                        properties_count,
+                                                        values_size, alloc);
+
+    _layout_release(obj->layout, alloc);
+    ct_array_free(obj->values, alloc);
+
+    _image_retain(image);
+    _image_release(obj->image);
+
+    obj->layout = layout;
+    obj->values = _frozen_values(layout);
+    obj->frozen = true;
+    obj->image = image;
+}
+
+static uint64_t _object_new_property(struct object_t *obj,
+                                     uint64_t key,
+                                     enum ct_cdb_type type,
+                                     size_t size,
+                                     const struct ct_alloc *alloc) {
+    struct object_layout_t *shape = obj->layout;
+
+    if (shape->shape && (shape->properties_count <= MAX_SHAPE_PROPERTIES)) {
+        struct object_layout_t *child = _shape_transition(shape, key, type,
+                                                          size);
+
+        if (child) {
+            const uint64_t prop_idx = shape->properties_count;
+
+            ct_array_resize(obj->values, child->values_size, alloc);
+            obj->layout = child;
+
+            return prop_idx;
+        }
+    }
+
+    _object_make_mutable(obj, alloc);
+
+    struct object_layout_t *layout = obj->layout;
+    const uint64_t values_size = layout->values_size;
+
+    if (size) {
+        ct_array_resize(obj->values, values_size + size, alloc);
+        layout->values_size = values_size + size;
+    }
+
+    return _layout_new_property(layout, key, type, values_size, alloc);
+}
+
+// Property set with other type get new value slot, old slot is left unused
+// because value size can differ.
+static void _object_retype_property(struct object_t *obj,
+                                    uint64_t idx,
+                                    enum ct_cdb_type type,
+                                    size_t size,
+                                    const struct ct_alloc *alloc) {
+    _object_make_mutable(obj, alloc);
+
+    struct object_layout_t *layout = obj->layout;
+    const uint64_t values_size = layout->values_size;
+
+    if (size) {
+        ct_array_resize(obj->values, values_size + size, alloc);
+        layout->values_size = values_size + size;
+    }
+
+    layout->property_type[idx] = type;
+    layout->offset[idx] = values_size;
+}
+
+static size_t _table_page_size(const struct table_t *table) {
+    return TABLE_ITEMS_OFFSET + (TABLE_PAGE_SIZE * table->item_size);
+}
+
+static void _table_init(struct table_t *table,
+                        uint64_t item_size) {
+    *table = (struct table_t) {
+            .item_size = item_size,
+    };
+
+    const size_t size = sizeof(*table->pages) * TABLE_MAX_PAGES;
+
+    table->pages = CT_ALLOC(_G.allocator, _Atomic(struct table_page_t *),
+                            size);
+    memset(table->pages, 0, size);
+
+    atomic_init(&table->used, 0);
+    atomic_init(&table->head, 0);
+}
+
+static bool _table_alloc_page(struct table_t *table,
+                              uint32_t page_idx) {
+    if (atomic_load(&table->pages[page_idx])) {
+        return true;
+    }
+
+    void *mem = mmap(NULL, _table_page_size(table),
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    struct table_page_t *page = mem;
+    struct table_page_t *expected = NULL;
+    if (!atomic_compare_exchange_strong(&table->pages[page_idx], &expected,
+                                        page)) {
+        // Other thread was faster.
+        munmap(mem, _table_page_size(table));
+    }
+
+    return true;
+}
+
+// Chain must be linked by next and end with 0.
+static void _table_push_chain(struct table_t *table,
+                              uint32_t first) {
+    atomic_uint *next_chain = _table_next_chain(table, first);
+
+    uint64_t head = atomic_load(&table->head);
+    uint64_t new_head;
+
+    do {
+        atomic_store(next_chain, (uint32_t) head);
+        new_head = (((head >> 32) + 1) << 32) | first;
+    } while (!atomic_compare_exchange_weak(&table->head, &head, new_head));
+}
+
+// Return first index of chain or 0 if list is empty.
+static uint32_t _table_pop_chain(struct table_t *table) {
+    uint64_t head = atomic_load(&table->head);
+
+    while ((uint32_t) head) {
+        const uint32_t first = (uint32_t) head;
+
+        // Link can be stale if other thread pop first, tag fail CAS.
+        const uint64_t next = (((head >> 32) + 1) << 32) |
+                              atomic_load(_table_next_chain(table, first));
+
+        if (atomic_compare_exchange_weak(&table->head, &head, next)) {
+            return first;
+        }
+    }
+
+    return 0;
+}
+
+static void _table_push_n(struct table_t *table,
+                          const uint32_t *idx,
+                          uint32_t n) {
+    if (!n) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+        atomic_store(_table_next(table, idx[i]),
+                     (i + 1) < n ? idx[i + 1] : 0);
+    }
+
+    _table_push_chain(table, idx[0]);
+}
+
+// Return items that were used to free list.
+static void _table_free_n(struct table_t *table,
+                          const uint32_t *idx,
+                          uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        atomic_fetch_sub(&_table_page(table, idx[i])->live, 1);
+    }
+
+    _table_push_n(table, idx, n);
+}
+
+// Fill magazine from free chain or take new range with one add.
+// Return 0 if table is full.
+static uint32_t _table_refill(struct table_t *table,
+                              uint32_t *idx) {
+    uint32_t it = _table_pop_chain(table);
+
+    if (it) {
+        uint32_t n = 0;
+        while (it) {
+            idx[n++] = it;
+            it = atomic_load(_table_next(table, it));
+        }
+
+        return n;
+    }
+
+    const uint64_t first = atomic_fetch_add(&table->used, MAGAZINE_SIZE);
+
+    // Range never cross page, page size is multiple of magazine size.
+    if (((first + MAGAZINE_SIZE) > MAX_OBJECTS) ||
+        !_table_alloc_page(table, (uint32_t) (first >> TABLE_PAGE_SHIFT))) {
+        atomic_fetch_sub(&table->used, MAGAZINE_SIZE);
+        return 0;
+    }
+
+    // Pop from end, keep new indices ascending. Index 0 is null.
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < MAGAZINE_SIZE; ++i) {
+        const uint32_t new_idx = (uint32_t) (first + (MAGAZINE_SIZE - 1 - i));
+
+        if (new_idx) {
+            idx[n++] = new_idx;
+        }
+    }
+
+    return n;
+}
+
+static uint32_t _table_pages_used(struct table_t *table) {
+    const uint64_t used = atomic_load(&table->used);
+    const uint64_t n = (used + TABLE_PAGE_MASK) >> TABLE_PAGE_SHIFT;
+
+    return (uint32_t) (n < TABLE_MAX_PAGES ? n : TABLE_MAX_PAGES);
+}
+
+// Mark item live, wait if gc release its page.
+static void _table_acquire(struct table_t *table,
+                           uint32_t idx) {
+    struct table_page_t *page = _table_page(table, idx);
+
+    uint32_t live = atomic_fetch_add(&page->live, 1);
+    while (live & TABLE_PAGE_RELEASING) {
+        live = atomic_load(&page->live);
+    }
+
+    if (atomic_load_explicit(&page->released, memory_order_relaxed)) {
+        atomic_store_explicit(&page->released, false, memory_order_relaxed);
+    }
+}
+
+// Release memory of pages without live items, items become zero.
+// Free items stay in free list, links are not released.
+static void _table_release_pages(struct table_t *table,
+                                 void (*clean)(void *item)) {
+    const size_t items_size = TABLE_PAGE_SIZE * table->item_size;
+    const uint32_t pages_n = _table_pages_used(table);
+
+    for (uint32_t i = 0; i < pages_n; ++i) {
+        struct table_page_t *page = atomic_load(&table->pages[i]);
+
+        if (!page) {
+            continue;
+        }
+
+        if (atomic_load(&page->released)) {
+            continue;
+        }
+
+        uint32_t live = 0;
+        if (!atomic_compare_exchange_strong(&page->live, &live,
+                                            TABLE_PAGE_RELEASING)) {
+            continue;
+        }
+
+        uint8_t *items = ((uint8_t *) page) + TABLE_ITEMS_OFFSET;
+
+        if (clean) {
+            for (uint32_t j = 0; j < TABLE_PAGE_SIZE; ++j) {
+                clean(items + (j * table->item_size));
+            }
+        }
+
+        // Map new zero pages over items.
+        mmap(items, items_size,
+             PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+             -1, 0);
+
+        atomic_store(&page->released, true);
+        atomic_fetch_and(&page->live, ~TABLE_PAGE_RELEASING);
+    }
+}
+
+static __thread struct magazine_t _magazine;
+
+static struct magazine_t *_get_magazine(struct db_t *db) {
+    struct magazine_t *mag = &_magazine;
+
+    if (mag->db == db->idx) {
+        return mag;
+    }
+
+    // Return cached indices to db they belong to.
+    struct db_t *old_db = &_G.dbs[mag->db];
+    _table_push_n(&old_db->objects, mag->objects, mag->objects_n);
+    _table_push_n(&old_db->ids, mag->ids, mag->ids_n);
+
+    *mag = (struct magazine_t) {.db = db->idx};
+
+    return mag;
+}
+
+struct object_t *_new_object(struct db_t *db) {
+    struct magazine_t *mag = _get_magazine(db);
+
+    if (!mag->objects_n) {
+        mag->objects_n = _table_refill(&db->objects, mag->objects);
+
+        CETECH_ASSERT(LOG_WHERE, mag->objects_n);
+    }
+
+    const uint32_t idx = mag->objects[--mag->objects_n];
+
+    _table_acquire(&db->objects, idx);
+
+    struct object_t *obj = _table_item(&db->objects, idx);
+    obj->idx = idx;
+    obj->db.idx = db->idx;
+
+    return obj;
+}
+
+static uint32_t _new_object_id(struct db_t *db_inst) {
+    struct magazine_t *mag = _get_magazine(db_inst);
+
+    if (!mag->ids_n) {
+        mag->ids_n = _table_refill(&db_inst->ids, mag->ids);
+
+        CETECH_ASSERT(LOG_WHERE, mag->ids_n);
+    }
+
+    const uint32_t idx = mag->ids[--mag->ids_n];
+
+    _table_acquire(&db_inst->ids, idx);
+
+    return idx;
+}
+
+static __thread struct epoch_thread_t *_epoch_thread;
+
+static struct epoch_thread_t *_get_epoch_thread() {
+    struct epoch_thread_t *t = _epoch_thread;
+
+    if (t) {
+        return t;
+    }
+
+    t = CT_ALLOC(_G.allocator, struct epoch_thread_t,
+                 sizeof(struct epoch_thread_t));
+
+    *t = (struct epoch_thread_t) {};
+    atomic_init(&t->epoch, 0);
+
+    // Records are never removed, record of finished thread stay idle.
+    t->next = atomic_load(&_G.epoch_threads);
+    while (!atomic_compare_exchange_weak(&_G.epoch_threads, &t->next, t)) {
+    }
+
+    _epoch_thread = t;
+    return t;
+}
+
+#if CT_PLATFORM_LINUX && defined(__NR_membarrier)
+#define HAS_HEAVY_BARRIER 1
+#endif
+
+// Heavy barrier is full fence on all threads of process. Reader can then
+// publish epoch with plain store and gc pay for fence once per advance.
+static bool _heavy_barrier_init() {
+#if HAS_HEAVY_BARRIER
+    return !syscall(__NR_membarrier,
+                    MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0);
+#else
+    return false;
+#endif
+}
+
+static void _heavy_barrier() {
+#if HAS_HEAVY_BARRIER
+    if (_G.heavy_barrier) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        return;
+    }
+#endif
+
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// Versions and data read between enter and exit are not freed, can nest.
+static void _epoch_enter() {
+    struct epoch_thread_t *t = _get_epoch_thread();
+
+    if (t->nesting++) {
+        return;
+    }
+
+    const uint64_t epoch = atomic_load_explicit(&_G.epoch,
+                                                memory_order_relaxed);
+
+    if (_G.heavy_barrier) {
+        atomic_store_explicit(&t->epoch, (epoch << 1) | 1,
+                              memory_order_relaxed);
+        atomic_signal_fence(memory_order_seq_cst);
+    } else {
+        atomic_store(&t->epoch, (epoch << 1) | 1);
+    }
+}
+
+static void _epoch_exit() {
+    struct epoch_thread_t *t = _epoch_thread;
+
+    if (--t->nesting) {
+        return;
+    }
+
+    atomic_store_explicit(&t->epoch, 0, memory_order_release);
+}
+
+// Advance if all reading threads are in actual epoch.
+static bool _epoch_try_advance() {
+    uint64_t epoch = atomic_load(&_G.epoch);
+
+    // Make epochs stored by readers visible.
+    _heavy_barrier();
+
+    struct epoch_thread_t *t = atomic_load(&_G.epoch_threads);
+    for (; t; t = t->next) {
+        const uint64_t thread_epoch = atomic_load(&t->epoch);
+
+        if (thread_epoch && ((thread_epoch >> 1) != epoch)) {
+            return false;
+        }
+    }
+
+    return atomic_compare_exchange_strong(&_G.epoch, &epoch, epoch + 1);
+}
+
+static void _reclaim_object(struct db_t *db_inst,
+                            uint32_t idx) {
+    struct object_t *obj = _table_item(&db_inst->objects, idx);
+
+    const uint32_t garbage_n = ct_array_size(obj->garbage);
+    for (int k = 0; k < garbage_n; ++k) {
+        _rc_release(obj->garbage[k]);
+    }
+
+    _layout_release(obj->layout, _G.allocator);
+    _image_release(obj->image);
+
+    struct object_layout_t *resolved = atomic_load(&obj->resolved);
+    if (resolved) {
+        CT_FREE(_G.allocator, resolved);
+    }
+
+//    ct_array_clean(obj->children);
+    ct_array_clean(obj->notify);
+    ct_array_clean(obj->garbage);
+
+    if (obj->frozen) {
+        obj->values = NULL;
+    } else {
+        ct_array_clean(obj->values);
+    }
+
+    *obj = (struct object_t) {
+//            .children = obj->children,
+            .values = obj->values,
+            .notify = obj->notify,
+            .garbage = obj->garbage,
+    };
+}
+
+// Freed indices are returned to free list as chains.
+struct free_batch_t {
+    uint32_t db;
+    uint32_t n;
+    uint32_t idx[MAGAZINE_SIZE];
+};
+
+static void _free_batch_flush(struct free_batch_t *batch,
+                              bool ids) {
+    struct db_t *db_inst = &_G.dbs[batch->db];
+
+    _table_free_n(ids ? &db_inst->ids : &db_inst->objects,
+                  batch->idx, batch->n);
+
+    batch->n = 0;
+}
+
+static void _free_batch_add(struct free_batch_t *batch,
+                            bool ids,
+                            uint32_t db,
+                            uint32_t idx) {
+    if (batch->n && ((batch->db != db) || (batch->n == MAGAZINE_SIZE))) {
+        _free_batch_flush(batch, ids);
+    }
+
+    batch->db = db;
+    batch->idx[batch->n++] = idx;
+}
+
+// Free at most budget retired items that no thread can use.
+// Caller hold t->lock.
+static void _epoch_reclaim(struct epoch_thread_t *t,
+                           uint32_t budget) {
+    const uint64_t epoch = atomic_load(&_G.epoch);
+    const uint32_t retired_n = ct_array_size(t->retired);
+
+    struct free_batch_t objects = {};
+    struct free_batch_t ids = {};
+
+    uint32_t i = t->retired_head;
+    for (; (i < retired_n) && budget; ++i, --budget) {
+        const struct retired_t *r = &t->retired[i];
+
+        // Retired in order, rest is newer.
+        if ((r->epoch + 2) > epoch) {
+            break;
+        }
+
+        switch (r->type) {
+            case RETIRED_OBJECT:
+                _reclaim_object(&_G.dbs[r->db], (uint32_t) r->data);
+                _free_batch_add(&objects, false, r->db, (uint32_t) r->data);
+                break;
+
+            case RETIRED_OBJECT_ID:
+                _free_batch_add(&ids, true, r->db, (uint32_t) r->data);
+                break;
+
+            case RETIRED_PTR:
+                CT_FREE(_G.allocator, (void *) r->data);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (objects.n) {
+        _free_batch_flush(&objects, false);
+    }
+
+    if (ids.n) {
+        _free_batch_flush(&ids, true);
+    }
+
+    t->retired_head = i;
+
+    if (t->retired_head == retired_n) {
+        ct_array_clean(t->retired);
+        t->retired_head = 0;
+    } else if (t->retired_head > (retired_n / 2)) {
+        const uint32_t rest = retired_n - t->retired_head;
+
+        memmove(t->retired, t->retired + t->retired_head,
+                sizeof(struct retired_t) * rest);
+
+        ct_array_header(t->retired)->size = rest;
+        t->retired_head = 0;
+    }
+}
+
+static void _epoch_retire(uint32_t type,
+                          uint32_t db,
+                          uint64_t data) {
+    struct epoch_thread_t *t = _get_epoch_thread();
+
+    struct retired_t r = {
+            .epoch = atomic_load(&_G.epoch),
+            .data = data,
+            .db = db,
+            .type = type,
+    };
+
+    ct_os_a0->thread->spin_lock(&t->lock);
+
+    ct_array_push(t->retired, r, _G.allocator);
+
+    // Thread that make garbage free it, gc only advance epoch.
+    if (!(ct_array_size(t->retired) % EPOCH_RECLAIM_PERIOD)) {
+        _epoch_reclaim(t, EPOCH_RECLAIM_PERIOD * 2);
+    }
+
+    ct_os_a0->thread->spin_unlock(&t->lock);
+}
+
+// New version of object share layout with orig and copy values.
+static struct object_t *_object_new_version(struct db_t *db,
+                                            struct object_t *obj,
+                                            const struct ct_alloc *alloc) {
+    const uint64_t values_size = obj->layout->values_size;
+
+    struct object_t *new_obj = _new_object(db);
+
+    new_obj->db = obj->db;
+    new_obj->id = obj->id;
+    new_obj->prefab = obj->prefab;
+    new_obj->parent = obj->parent;
+    new_obj->type = obj->type;
+
+    _layout_retain(obj->layout);
+    new_obj->layout = obj->layout;
+
+    if (obj->image) {
+        _image_retain(obj->image);
+        new_obj->image = obj->image;
+    }
+
+    if (values_size) {
+        ct_array_push_n(new_obj->values, obj->values, values_size, alloc);
+    }
+
+//    n = ct_array_size(obj->children);
+//    if (n) {
+//        ct_array_push_n(new_obj->children, obj->children, n, alloc);
+//    }
+
+    uint32_t n = ct_array_size(obj->notify);
+    if (n) {
+        ct_array_push_n(new_obj->notify, obj->notify, n, alloc);
+    }
+
+    return new_obj;
+}
+
+// Binary search in sorted keys of frozen layout.
+static uint64_t _frozen_find_prop_index(const struct object_layout_t *layout,
+                                        uint64_t key) {
+    const uint64_t *keys = layout->keys;
+
+    uint64_t first = 1;
+    uint64_t count = layout->properties_count - 1;
+
+    while (count) {
+        const uint64_t half = count / 2;
+
+        if (keys[first + half] < key) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+
+    if ((first < layout->properties_count) && (keys[first] == key)) {
+        return first;
+    }
+
+    return 0;
+}
+
+static uint64_t _find_prop_index(const struct object_t *obj,
+                                 uint64_t key) {
+    if (obj->layout->frozen) {
+        return _frozen_find_prop_index(obj->layout, key);
+    }
+
+    return ct_hash_lookup(&obj->layout->prop_map, key, 0);
+}
+
+static void _object_invalidate_resolved(struct object_t *obj) {
+    atomic_fetch_add(&obj->resolved_gen, 1);
+
+    struct object_layout_t *resolved = atomic_exchange(&obj->resolved, NULL);
+
+    if (!resolved) {
+        return;
+    }
+
+    // Readers can still use it.
+    _epoch_retire(RETIRED_PTR, 0, (uint64_t) resolved);
+}
+
+static struct object_layout_t *_object_resolved(struct object_t *obj);
+
+// Properties inherited by instances of prefab version.
+// Prefab without own prefab is read directly.
+static struct object_layout_t *_prefab_view(struct object_t *prefab,
+                                            uint8_t **values) {
+    if (!prefab->prefab) {
+        *values = prefab->values;
+        return prefab->layout;
+    }
+
+    struct object_layout_t *resolved = _object_resolved(prefab);
+    *values = _frozen_values(resolved);
+    return resolved;
+}
+
+// Flatten own properties and properties from prefab chain to frozen layout.
+// Whole chain is resolved once so read through instance is one lookup
+// instead of one per prefab level.
+static struct object_layout_t *_object_resolved(struct object_t *obj) {
+    struct object_layout_t *resolved = atomic_load(&obj->resolved);
+
+    if (resolved) {
+        return resolved;
+    }
+
+    const uint32_t gen = atomic_load(&obj->resolved_gen);
+
+    uint8_t *prefab_values;
+    struct object_t *prefab = _get_object_from_objid(obj->prefab);
+    struct object_layout_t *prefab_layout = _prefab_view(prefab,
+                                                         &prefab_values);
+
+    struct object_layout_t *layout = obj->layout;
+
+    uint64_t n = layout->properties_count - 1;
+    uint64_t values_size = 0;
+
+    for (uint64_t i = 1; i < layout->properties_count; ++i) {
+        values_size += (_type_size[layout->property_type[i]] + 7) & ~7ULL;
+    }
+
+    for (uint64_t i = 1; i < prefab_layout->properties_count; ++i) {
+        if (_find_prop_index(obj, prefab_layout->keys[i])) {
+            continue;
+        }
+
+        const uint8_t type = prefab_layout->property_type[i];
+        values_size += (_type_size[type] + 7) & ~7ULL;
+        ++n;
+    }
+
+    resolved = _frozen_layout_alloc(n, values_size, _G.allocator);
+    uint8_t *values = _frozen_values(resolved);
+
+    uint64_t idx = 1;
+    uint64_t offset = 0;
+
+    for (uint64_t i = 1; i < layout->properties_count; ++i) {
+        const uint8_t type = layout->property_type[i];
+
+        resolved->keys[idx] = layout->keys[i];
+        resolved->property_type[idx] = type;
+        resolved->offset[idx] = offset;
+
+        memcpy(values + offset, obj->values + layout->offset[i],
+               _type_size[type]);
+
+        offset += (_type_size[type] + 7) & ~7ULL;
+        ++idx;
+    }
+
+    for (uint64_t i = 1; i < prefab_layout->properties_count; ++i) {
+        if (_find_prop_index(obj, prefab_layout->keys[i])) {
+            continue;
+        }
+
+        const uint8_t type = prefab_layout->property_type[i];
+
+        resolved->keys[idx] = prefab_layout->keys[i];
+        resolved->property_type[idx] = type;
+        resolved->offset[idx] = offset;
+
+        memcpy(values + offset, prefab_values + prefab_layout->offset[i],
+               _type_size[type]);
+
+        offset += (_type_size[type] + 7) & ~7ULL;
+        ++idx;
+    }
+
+    _frozen_layout_sort(resolved);
+
+    struct object_layout_t *expected = NULL;
+    if (!atomic_compare_exchange_strong(&obj->resolved, &expected,
+                                        resolved)) {
+        // Other thread was faster.
+        CT_FREE(_G.allocator, resolved);
+        return expected;
+    }
+
+    // Prefab changed while building, drop it for next read.
+    if (atomic_load(&obj->resolved_gen) != gen) {
+        _object_invalidate_resolved(obj);
+    }
+
+    return resolved;
+}
+
+// Value of property from object or prefab chain.
+static uint8_t *_get_value(struct object_t *obj,
+                           uint64_t key,
+                           enum ct_cdb_type *type) {
+    uint64_t idx = _find_prop_index(obj, key);
+
+    if (idx) {
+        *type = (enum ct_cdb_type) obj->layout->property_type[idx];
+        return obj->values + obj->layout->offset[idx];
+    }
+
+    if (!obj->prefab) {
+        return NULL;
+    }
+
+    uint8_t *values;
+    struct object_t *prefab = _get_object_from_objid(obj->prefab);
+    struct object_layout_t *layout = _prefab_view(prefab, &values);
+
+    idx = layout->frozen ? _frozen_find_prop_index(layout, key)
+                         : ct_hash_lookup(&layout->prop_map, key, 0);
+
+    if (!idx) {
+        return NULL;
+    }
+
+    *type = (enum ct_cdb_type) layout->property_type[idx];
+    return values + layout->offset[idx];
+}
+
+static void _destroy_object(struct object_t *obj) {
+    _epoch_retire(RETIRED_OBJECT, obj->db.idx, obj->idx);
+}
+
+// Last version of destroyed object release str/blob values with it.
+static void _object_release_values(struct object_t *obj) {
+    struct object_layout_t *layout = obj->layout;
+
+    for (int i = 1; i < layout->properties_count; ++i) {
+        union type_u *value_ptr = (union type_u *) (obj->values +
+                                                    layout->offset[i]);
+
+        void *data;
+        switch (layout->property_type[i]) {
+            case CDB_TYPE_STR:
+                data = value_ptr->str;
+                break;
+
+            case CDB_TYPE_BLOB:
+                data = value_ptr->blob.data;
+                break;
+
+            default:
+                continue;
+        }
+
+        if (!_image_contains(obj->image, data)) {
+            ct_array_push(obj->garbage, data, _G.allocator);
+        }
+    }
+}
+
+// Free arrays kept in free object for reuse.
+static void _clean_object_slot(void *item) {
+    struct object_t *obj = item;
+
+//    ct_array_free(obj->children, _G.allocator);
+    ct_array_free(obj->notify, _G.allocator);
+    ct_array_free(obj->garbage, _G.allocator);
+    ct_array_free(obj->values, _G.allocator);
+}
+
+static struct instances_t *_instances(uint64_t objid) {
+    struct object_id_t *id = (struct object_id_t *) objid;
+    return atomic_load_explicit(&id->instances, memory_order_acquire);
+}
+
+static uint32_t _instances_n(const struct instances_t *instances) {
+    return instances ? atomic_load_explicit(&instances->n,
+                                            memory_order_acquire) : 0;
+}
+
+static uint64_t _instances_get(struct instances_t *instances,
+                               uint32_t idx) {
+    return atomic_load_explicit(&instances->objid[idx],
+                                memory_order_relaxed);
+}
+
+static void _instances_add(uint64_t prefab,
+                           uint64_t inst) {
+    struct object_id_t *id = (struct object_id_t *) prefab;
+
+    ct_os_a0->thread->spin_lock(&_G.instances_lock);
+
+    struct instances_t *instances = atomic_load(&id->instances);
+    const uint32_t n = _instances_n(instances);
+
+    if (!instances || (n == instances->capacity)) {
+        const uint32_t capacity = n ? n * 2 : 4;
+
+        struct instances_t *new_instances = CT_ALLOC(
+                _G.allocator, struct instances_t,
+                sizeof(struct instances_t) +
+                (sizeof(atomic_ullong) * capacity));
+
+        new_instances->capacity = capacity;
+        atomic_init(&new_instances->n, n);
+
+        for (uint32_t i = 0; i < n; ++i) {
+            atomic_init(&new_instances->objid[i],
+                        _instances_get(instances, i));
+        }
+
+        atomic_store_explicit(&id->instances, new_instances,
+                              memory_order_release);
+
+        if (instances) {
+            _epoch_retire(RETIRED_PTR, 0, (uint64_t) instances);
+        }
+
+        instances = new_instances;
+    }
+
+    atomic_store_explicit(&instances->objid[n], inst, memory_order_relaxed);
+    atomic_store_explicit(&instances->n, n + 1, memory_order_release);
+
+    ct_os_a0->thread->spin_unlock(&_G.instances_lock);
+}
+
+static void _instances_remove(uint64_t prefab,
+                              uint64_t inst) {
+    ct_os_a0->thread->spin_lock(&_G.instances_lock);
+
+    struct instances_t *instances = _instances(prefab);
+    const uint32_t n = _instances_n(instances);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        if (_instances_get(instances, i) != inst) {
+            continue;
+        }
+
+        atomic_store_explicit(&instances->objid[i],
+                              _instances_get(instances, n - 1),
+                              memory_order_relaxed);
+
+        atomic_store_explicit(&instances->n, n - 1, memory_order_release);
+        break;
+    }
+
+    ct_os_a0->thread->spin_unlock(&_G.instances_lock);
+}
+
+// Destroyed object has no instances.
+static void _instances_free(uint64_t objid) {
+    struct object_id_t *id = (struct object_id_t *) objid;
+
+    struct instances_t *instances = atomic_exchange(&id->instances, NULL);
+
+    if (instances) {
+        _epoch_retire(RETIRED_PTR, 0, (uint64_t) instances);
+    }
+}
+
+#define INDEX_NONE UINT32_MAX
+
+static struct index_entry_t *_index_entry(struct index_entry_t **entries,
+                                          uint32_t id) {
+    const uint32_t n = ct_array_size(*entries);
+
+    if (id >= n) {
+        const uint32_t new_n = (n * 2) > id ? (n * 2) : (id + 1);
+        ct_array_resize(*entries, new_n, _G.allocator);
+
+        for (uint32_t i = n; i < new_n; ++i) {
+            (*entries)[i] = (struct index_entry_t) {.pos = INDEX_NONE};
+        }
+    }
+
+    return &(*entries)[id];
+}
+
+static bool _index_contains(const struct index_entry_t *entries,
+                            uint32_t id) {
+    return (id < ct_array_size(entries)) && (entries[id].pos != INDEX_NONE);
+}
+
+static void _index_set_add(uint32_t **ids,
+                           struct index_entry_t *entries,
+                           uint32_t set,
+                           uint32_t id) {
+    entries[id] = (struct index_entry_t) {
+            .set = set,
+            .pos = ct_array_size(*ids),
+    };
+
+    ct_array_push(*ids, id, _G.allocator);
+}
+
+// Swap last id to removed position.
+static void _index_set_remove(uint32_t *ids,
+                              struct index_entry_t *entries,
+                              uint32_t id) {
+    const uint32_t pos = entries[id].pos;
+    const uint32_t last = ct_array_back(ids);
+
+    ids[pos] = last;
+    entries[last].pos = pos;
+    ct_array_pop_back(ids);
+
+    entries[id].pos = INDEX_NONE;
+}
+
+static uint32_t _type_index_find(struct db_t *db_inst,
+                                 uint64_t type) {
+    return (uint32_t) ct_hash_lookup(&db_inst->type_map, type, INDEX_NONE);
+}
+
+static uint32_t _type_index_get(struct db_t *db_inst,
+                                uint64_t type) {
+    uint32_t idx = _type_index_find(db_inst, type);
+
+    if (idx == INDEX_NONE) {
+        idx = ct_array_size(db_inst->type_index);
+
+        struct type_index_t type_index = {.type = type};
+        ct_array_push(db_inst->type_index, type_index, _G.allocator);
+        ct_hash_add(&db_inst->type_map, type, idx, _G.allocator);
+    }
+
+    return idx;
+}
+
+static struct value_index_t *_value_index_find(struct type_index_t *ti,
+                                               uint64_t prop) {
+    const uint32_t n = ct_array_size(ti->value_index);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        if (ti->value_index[i].prop == prop) {
+            return &ti->value_index[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Only scalar values are indexed.
+static bool _value_index_key(struct object_t *obj,
+                             uint64_t prop,
+                             uint64_t *key) {
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, prop, &type);
+
+    if (!value) {
+        return false;
+    }
+
+    switch (type) {
+        case CDB_TYPE_UINT64:
+        case CDB_TYPE_REF:
+        case CDB_TYPE_SUBOBJECT:
+            *key = *(uint64_t *) value;
+            return true;
+
+        case CDB_TYPE_BOOL:
+            *key = *(bool *) value;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void _value_index_update(struct value_index_t *vi,
+                                struct object_t *obj) {
+    struct index_entry_t *entry = _index_entry(&vi->entries, obj->id);
+
+    uint64_t key;
+    const bool has_key = _value_index_key(obj, vi->prop, &key);
+
+    if (entry->pos != INDEX_NONE) {
+        struct value_bucket_t *bucket = &vi->buckets[entry->set];
+
+        if (has_key && (bucket->value == key)) {
+            return;
+        }
+
+        _index_set_remove(bucket->ids, vi->entries, obj->id);
+    }
+
+    if (!has_key) {
+        return;
+    }
+
+    uint32_t bucket = (uint32_t) ct_hash_lookup(&vi->bucket_map, key,
+                                                INDEX_NONE);
+
+    if (bucket == INDEX_NONE) {
+        bucket = ct_array_size(vi->buckets);
+
+        struct value_bucket_t new_bucket = {.value = key};
+        ct_array_push(vi->buckets, new_bucket, _G.allocator);
+        ct_hash_add(&vi->bucket_map, key, bucket, _G.allocator);
+    }
+
+    _index_set_add(&vi->buckets[bucket].ids, vi->entries, bucket, obj->id);
+}
+
+// Add object to index of its type if not there and update its values.
+static void _index_object(struct object_t *obj) {
+    if (!obj->type) {
+        return;
+    }
+
+    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+
+    ct_os_a0->thread->spin_lock(&db_inst->index_lock);
+
+    const uint32_t idx = _type_index_get(db_inst, obj->type);
+    struct type_index_t *ti = &db_inst->type_index[idx];
+
+    struct index_entry_t *entry = _index_entry(&db_inst->index_entries,
+                                               obj->id);
+
+    if (entry->pos == INDEX_NONE) {
+        _index_set_add(&ti->ids, db_inst->index_entries, idx, obj->id);
+    }
+
+    const uint32_t value_index_n = ct_array_size(ti->value_index);
+    for (uint32_t i = 0; i < value_index_n; ++i) {
+        _value_index_update(&ti->value_index[i], obj);
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->index_lock);
+}
+
+static void _index_remove(struct db_t *db_inst,
+                          uint32_t id) {
+    ct_os_a0->thread->spin_lock(&db_inst->index_lock);
+
+    if (_index_contains(db_inst->index_entries, id)) {
+        const uint32_t idx = db_inst->index_entries[id].set;
+        struct type_index_t *ti = &db_inst->type_index[idx];
+
+        const uint32_t value_index_n = ct_array_size(ti->value_index);
+        for (uint32_t i = 0; i < value_index_n; ++i) {
+            struct value_index_t *vi = &ti->value_index[i];
+
+            if (!_index_contains(vi->entries, id)) {
+                continue;
+            }
+
+            const uint32_t bucket = vi->entries[id].set;
+            _index_set_remove(vi->buckets[bucket].ids, vi->entries, id);
+        }
+
+        _index_set_remove(ti->ids, db_inst->index_entries, id);
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->index_lock);
+}
+
+// Values of object changed, instances inherit them.
+static void _index_update(uint64_t _obj) {
+    struct object_t *obj = _get_object_from_objid(_obj);
+    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+
+    if (!atomic_load_explicit(&db_inst->value_index_n,
+                              memory_order_relaxed)) {
+        return;
+    }
+
+    ct_os_a0->thread->spin_lock(&db_inst->index_lock);
+
+    if (_index_contains(db_inst->index_entries, obj->id)) {
+        const uint32_t idx = db_inst->index_entries[obj->id].set;
+        struct type_index_t *ti = &db_inst->type_index[idx];
+
+        const uint32_t value_index_n = ct_array_size(ti->value_index);
+        for (uint32_t i = 0; i < value_index_n; ++i) {
+            _value_index_update(&ti->value_index[i], obj);
+        }
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->index_lock);
+
+    struct instances_t *instances = _instances(_obj);
+    const uint32_t instances_n = _instances_n(instances);
+    for (uint32_t i = 0; i < instances_n; ++i) {
+        _index_update(_instances_get(instances, i));
+    }
+}
+
+static uint32_t _index_copy(struct db_t *db_inst,
+                            const uint32_t *ids,
+                            uint64_t *objs,
+                            uint32_t max) {
+    const uint32_t n = ct_array_size(ids);
+    const uint32_t copy_n = n < max ? n : max;
+
+    for (uint32_t i = 0; i < copy_n; ++i) {
+        objs[i] = (uint64_t) _table_item(&db_inst->ids, ids[i]);
+    }
+
+    return n;
+}
+
+static uint32_t query_type(struct ct_cdb_t db,
+                           uint64_t type,
+                           uint64_t *objs,
+                           uint32_t max) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+
+    ct_os_a0->thread->spin_lock(&db_inst->index_lock);
+
+    uint32_t n = 0;
+    const uint32_t idx = _type_index_find(db_inst, type);
+
+    if (idx != INDEX_NONE) {
+        n = _index_copy(db_inst, db_inst->type_index[idx].ids, objs, max);
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->index_lock);
+
+    return n;
+}
+
+static void create_index(struct ct_cdb_t db,
+                         uint64_t type,
+                         uint64_t prop) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+
+    _epoch_enter();
+    ct_os_a0->thread->spin_lock(&db_inst->index_lock);
+
+    struct type_index_t *ti;
+    ti = &db_inst->type_index[_type_index_get(db_inst, type)];
+
+    if (!_value_index_find(ti, prop)) {
+        struct value_index_t value_index = {.prop = prop};
+        ct_array_push(ti->value_index, value_index, _G.allocator);
+
+        struct value_index_t *vi = &ct_array_back(ti->value_index);
+
+        const uint32_t n = ct_array_size(ti->ids);
+        for (uint32_t i = 0; i < n; ++i) {
+            atomic_ullong *obj_addr = _table_item(&db_inst->ids, ti->ids[i]);
+            struct object_t *obj = \
+                _get_object_from_objid((uint64_t) obj_addr);
+
+            _value_index_update(vi, obj);
+        }
+
+        atomic_fetch_add(&db_inst->value_index_n, 1);
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->index_lock);
+    _epoch_exit();
+}
+
+static uint32_t query_value(struct ct_cdb_t db,
+                            uint64_t type,
+                            uint64_t prop,
+                            uint64_t value,
+                            uint64_t *objs,
+                            uint32_t max) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+
+    ct_os_a0->thread->spin_lock(&db_inst->index_lock);
+
+    uint32_t n = 0;
+    const uint32_t idx = _type_index_find(db_inst, type);
+
+    if (idx != INDEX_NONE) {
+        struct type_index_t *ti = &db_inst->type_index[idx];
+        struct value_index_t *vi = _value_index_find(ti, prop);
+
+        const uint32_t bucket = !vi ? INDEX_NONE : \
+            (uint32_t) ct_hash_lookup(&vi->bucket_map, value, INDEX_NONE);
+
+        if (bucket != INDEX_NONE) {
+            n = _index_copy(db_inst, vi->buckets[bucket].ids, objs, max);
+        }
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->index_lock);
+
+    return n;
+}
+
+static struct ct_cdb_t create_db() {
+    uint64_t idx = ct_array_size(_G.dbs);
+
+    struct db_t db = (struct db_t) {
+            .idx = idx,
+    };
+
+    _table_init(&db.ids, sizeof(struct object_id_t));
+    _table_init(&db.objects, sizeof(struct object_t));
+
+    ct_array_push(_G.dbs, db, _G.allocator);
+    return (struct ct_cdb_t) {.idx = idx};
+};
+
+static uint64_t create_object(struct ct_cdb_t db,
+                              uint64_t type) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+    struct object_t *obj = _new_object(db_inst);
+
+    uint32_t idx = _new_object_id(db_inst);
+
+    atomic_ullong *obj_addr = _table_item(&db_inst->ids, idx);
+
+    obj->db = db;
+    obj->id = idx;
+    obj->type = type;
+    obj->layout = _G.root_shape;
+
+    atomic_store(obj_addr, obj->idx);
+
+    _index_object(obj);
+
+    return (uint64_t) obj_addr;
+}
+
+// Instance share prefab values, subobjects are instanced on first read.
+static uint64_t create_from(struct ct_cdb_t db,
+                            uint64_t _obj) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+
+    _epoch_enter();
+
+    struct object_t *obj = _get_object_from_objid(_obj);
+
+    struct object_t *inst = _new_object(db_inst);
+    inst->db = db;
+    inst->layout = _G.root_shape;
+
+    uint32_t idx = _new_object_id(db_inst);
+
+    atomic_ullong *obj_addr = _table_item(&db_inst->ids, idx);
+
+    inst->id = idx;
+    inst->prefab = _obj;
+    inst->type = obj->type;
+
+    atomic_store(obj_addr, inst->idx);
+
+    _index_object(inst);
+
+    _instances_add(_obj, (uint64_t) obj_addr);
+
+    uint32_t n = ct_array_size(obj->notify);
+    if (n) {
+        ct_array_push_n(inst->notify, obj->notify, n, _G.allocator);
+    }
+
+    _epoch_exit();
+
+    return (uint64_t) obj_addr;
+}
+
+static void _table_stats(struct table_t *table,
+                         struct ct_cdb_stats_t *stats) {
+    const uint64_t items_size = TABLE_PAGE_SIZE * table->item_size;
+    const uint32_t pages_n = _table_pages_used(table);
+
+    for (uint32_t i = 0; i < pages_n; ++i) {
+        struct table_page_t *page = atomic_load(&table->pages[i]);
+
+        if (!page) {
+            continue;
+        }
+
+        const uint32_t live = atomic_load(&page->live) &
+                              ~TABLE_PAGE_RELEASING;
+
+        stats->live_bytes += live * table->item_size;
+        stats->committed_bytes += TABLE_ITEMS_OFFSET;
+
+        // Released page keep only header until reuse.
+        if (!atomic_load(&page->released)) {
+            stats->committed_bytes += items_size;
+            stats->free_bytes += items_size - (live * table->item_size);
+        }
+    }
+}
+
+static void stats(struct ct_cdb_t db,
+                  struct ct_cdb_stats_t *stats) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+
+    *stats = (struct ct_cdb_stats_t) {};
+
+    _table_stats(&db_inst->objects, stats);
+    _table_stats(&db_inst->ids, stats);
+}
+
+static void destroy_db(struct ct_cdb_t db) {
+    ct_array_push(_G.to_free_db, db.idx, _G.allocator);
+}
+
+static void destroy_object(uint64_t _obj) {
+    _epoch_enter();
+
+    struct object_t *obj = _get_object_from_objid(_obj);
+    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+
+    ct_os_a0->thread->spin_lock(&db_inst->destroy_lock);
+    ct_array_push(db_inst->to_free_objects_id, obj->id, _G.allocator);
+    ct_os_a0->thread->spin_unlock(&db_inst->destroy_lock);
+
+    _index_remove(db_inst, obj->id);
+
+    struct object_layout_t *layout = obj->layout;
+    for (int i = 1; i < layout->properties_count; ++i) {
+        switch (layout->property_type[i]) {
+            case CDB_TYPE_SUBOBJECT: {
+                union type_u *value_ptr = (union type_u *) (obj->values +
+                                                            layout->offset[i]);
+
+                uint64_t old_subobj = value_ptr->subobj;
+                destroy_object(old_subobj);
+            }
+
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    _epoch_exit();
+}
+
+
+static void gc() {
+    _epoch_enter();
+
+    const uint32_t db_n = ct_array_size(_G.dbs);
+    for (int i = 0; i < db_n; ++i) {
+        struct db_t *db_inst = &_G.dbs[i];
+
+        ct_os_a0->thread->spin_lock(&db_inst->destroy_lock);
+        uint32_t *to_free_objects_id = db_inst->to_free_objects_id;
+        db_inst->to_free_objects_id = NULL;
+        ct_os_a0->thread->spin_unlock(&db_inst->destroy_lock);
+
+        const uint32_t to_free_objects_id_n = \
+                ct_array_size(to_free_objects_id);
+
+        for (int j = 0; j < to_free_objects_id_n; ++j) {
+            const uint32_t idx = to_free_objects_id[j];
+
+            atomic_ullong *obj_addr = _table_item(&db_inst->ids, idx);
+            struct object_t *obj = _get_object_from_objid((uint64_t) obj_addr);
+
+            if (obj->prefab) {
+                _instances_remove(obj->prefab, (uint64_t) obj_addr);
+            }
+
+            _instances_free((uint64_t) obj_addr);
+
+            _object_release_values(obj);
+            _destroy_object(obj);
+            _epoch_retire(RETIRED_OBJECT_ID, i, idx);
+        }
+
+        ct_array_free(to_free_objects_id, _G.allocator);
+    }
+
+    _epoch_exit();
+
+    // Without readers two steps make all retired items free.
+    if (_epoch_try_advance()) {
+        _epoch_try_advance();
+    }
+
+    // Free garbage of threads that stop writing, bounded per call.
+    struct epoch_thread_t *t = atomic_load(&_G.epoch_threads);
+    for (; t; t = t->next) {
+        ct_os_a0->thread->spin_lock(&t->lock);
+        _epoch_reclaim(t, EPOCH_RECLAIM_BUDGET);
+        ct_os_a0->thread->spin_unlock(&t->lock);
+    }
+
+    // Give back memory of pages without live items.
+    for (int i = 0; i < db_n; ++i) {
+        struct db_t *db_inst = &_G.dbs[i];
+
+        _table_release_pages(&db_inst->objects, _clean_object_slot);
+        _table_release_pages(&db_inst->ids, NULL);
+    }
+}
+
+#define CDB_BINOBJ_VERSION 1
+
+// Binary object from dump, parts are aligned to 8 bytes:
+// header, keys, offsets and types as in frozen layout (index 0 is null,
+// keys are sorted), values, strings, subobjects and blobs.
+// Str, subobject and blob values are offsets to its buffer and load
+// relocate them. Blob in buffer is size followed by data.
+struct cdb_binobj_header {
+    uint64_t version;
+    uint64_t type;
+    uint64_t properties_count;
+    uint64_t values_size;
+    uint64_t string_buffer_size;
+    uint64_t subobject_buffer_size;
+    uint64_t blob_buffer_size;
+};
+
+// Checkpoint file from save_image: header, entries sorted by key and
+// binary objects of entries. Entry offset is from start of objects.
+#define CDB_IMAGE_MAGIC 0x4547414d49424443ULL // "CDBIMAGE"
+#define CDB_IMAGE_VERSION 1
+
+struct cdb_image_header {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t binobj_version;
+    uint64_t entries_count;
+    uint64_t data_size;
+};
+
+struct cdb_image_entry {
+    uint64_t key;
+    uint64_t source_hash;
+    uint64_t offset;
+    uint64_t size;
+};
+
+static uint64_t _align8(uint64_t size) {
+    return (size + 7) & ~7ULL;
+}
+
+// Size of keys, offsets and types.
+static uint64_t _binobj_tables_size(uint64_t properties_count) {
+    const uint64_t n = properties_count + 1;
+    return (sizeof(uint64_t) * n * 2) + _align8(n);
+}
+
+static uint64_t _binobj_size(const struct cdb_binobj_header *header) {
+    return sizeof(struct cdb_binobj_header) +
+           _binobj_tables_size(header->properties_count) +
+           _align8(header->values_size) +
+           header->string_buffer_size +
+           header->subobject_buffer_size +
+           header->blob_buffer_size;
+}
+
+// Pad data added to array since start with zeros.
+static void _binobj_pad(char **output,
+                        uint64_t start,
+                        struct ct_alloc *allocator) {
+    static const char zero[8] = {};
+
+    const uint64_t size = ct_array_size(*output) - start;
+    const uint64_t pad = _align8(size) - size;
+
+    if (pad) {
+        ct_array_push_n(*output, zero, pad, allocator);
+    }
+}
+
+static uint64_t read_subobject(uint64_t _obj,
+                               uint64_t property,
+                               uint64_t defaultt);
+
+// Instance inherited subobjects not read yet, so they are dumped as own
+// like any other subobject of instance.
+static void _instance_inherited_subobjects(uint64_t _obj) {
+    struct object_t *obj = _get_object_from_objid(_obj);
+
+    if (!obj->prefab) {
+        return;
+    }
+
+    uint8_t *values;
+    struct object_t *prefab = _get_object_from_objid(obj->prefab);
+    struct object_layout_t *layout = _prefab_view(prefab, &values);
+
+    for (uint64_t i = 1; i < layout->properties_count; ++i) {
+        if (layout->property_type[i] != CDB_TYPE_SUBOBJECT) {
+            continue;
+        }
+
+        read_subobject(_obj, layout->keys[i], 0);
+    }
+}
+
+static void dump(uint64_t _obj,
+                 char **output,
+                 struct ct_alloc *allocator) {
+    _epoch_enter();
+
+    _instance_inherited_subobjects(_obj);
+
+    struct object_t *obj = _get_object_from_objid(_obj);
+    struct object_layout_t *layout = obj->layout;
+
+    const uint64_t properties_count = layout->properties_count - 1;
+    const uint64_t values_size = layout->values_size;
+
+    // Sorted tables with values copy are written as is.
+    struct object_layout_t *copy = _frozen_layout_alloc(properties_count,
+                                                        values_size,
+                                                        allocator);
+
+    memcpy(copy->keys + 1, layout->keys + 1,
+           sizeof(uint64_t) * properties_count);
+    memcpy(copy->offset + 1, layout->offset + 1,
+           sizeof(uint64_t) * properties_count);
+    memcpy(copy->property_type + 1, layout->property_type + 1,
+           properties_count);
+
+    _frozen_layout_sort(copy);
+
+    uint8_t *values = _frozen_values(copy);
+    if (values_size) {
+        memcpy(values, obj->values, values_size);
+    }
+
+    uint64_t *offset = copy->offset;
+    uint8_t *type = copy->property_type;
+
+    char *str_buffer = NULL;
+    char *subobject_buffer = NULL;
+    char *blob_buffer = NULL;
+    for (int i = 1; i < copy->properties_count; ++i) {
+        switch (type[i]) {
+            case CDB_TYPE_SUBOBJECT: {
+                uint64_t subobject_offset = ct_array_size(subobject_buffer);
+                uint64_t subobject_ptr;
+
+                union type_u *value_ptr = (union type_u *) (values +
+                                                            offset[i]);
+                subobject_ptr = value_ptr->subobj;
+
+                dump(subobject_ptr, &subobject_buffer, allocator);
+
+                uint64_t *ptr = (uint64_t *) (values + offset[i]);
+                *ptr = subobject_offset;
+            }
+
+                break;
+
+            case CDB_TYPE_STR: {
+                uint64_t stroffset = ct_array_size(str_buffer);
+                char *str = *(char **) (values + offset[i]);
+                ct_array_push_n(str_buffer, str, strlen(str) + 1, allocator);
+
+                uint64_t *strptr = (uint64_t *) (values + offset[i]);
+                *strptr = stroffset;
+            }
+                break;
+
+            case CDB_TYPE_BLOB: {
+                uint64_t bloboffset = ct_array_size(blob_buffer);
+
+                struct blob_t *blob;
+                blob = (struct blob_t *) (values + offset[i]);
+
+                ct_array_push_n(blob_buffer, &blob->size, sizeof(uint64_t),
+                                allocator);
+
+                ct_array_push_n(blob_buffer, blob->data, blob->size, allocator);
+                _binobj_pad(&blob_buffer, 0, allocator);
+
+                uint64_t *blobptr = (uint64_t *) (values + offset[i]);
+                *blobptr = bloboffset;
+            }
+                break;
+            default:
+                break;
+        }
+    }
+
+    _binobj_pad(&str_buffer, 0, allocator);
+
+    struct cdb_binobj_header header = {
+            .version = CDB_BINOBJ_VERSION,
+            .type = obj->type,
+            .properties_count = properties_count,
+            .values_size = values_size,
+            .string_buffer_size = ct_array_size(str_buffer),
+            .subobject_buffer_size = ct_array_size(subobject_buffer),
+            .blob_buffer_size = ct_array_size(blob_buffer),
+    };
+
+    const uint64_t start = ct_array_size(*output);
+
+    ct_array_push_n(*output, (char *) &header,
+                    sizeof(struct cdb_binobj_header),
+                    allocator);
+
+    ct_array_push_n(*output, (char *) copy->keys,
+                    _binobj_tables_size(properties_count) + values_size,
+                    allocator);
+
+    _binobj_pad(output, start, allocator);
+
+    // Empty buffer is NULL, memcpy from it would let compiler drop NULL
+    // check in ct_array_free.
+    if (header.string_buffer_size) {
+        ct_array_push_n(*output, str_buffer,
+                        header.string_buffer_size,
+                        allocator);
+    }
+
+    if (header.subobject_buffer_size) {
+        ct_array_push_n(*output, subobject_buffer,
+                        header.subobject_buffer_size,
+                        allocator);
+    }
+
+    if (header.blob_buffer_size) {
+        ct_array_push_n(*output, blob_buffer,
+                        header.blob_buffer_size,
+                        allocator);
+    }
+
+    ct_array_free(str_buffer, allocator);
+    ct_array_free(subobject_buffer, allocator);
+    ct_array_free(blob_buffer, allocator);
+    CT_FREE(allocator, copy);
+
+    _epoch_exit();
+}
+
+static void _load(struct ct_cdb_t db,
+                  struct image_t *image,
+                  char *input,
+                  uint64_t _obj) {
+    struct cdb_binobj_header *header = (struct cdb_binobj_header *) input;
+
+    struct object_t *obj = _get_object_from_objid(_obj);
+    if (!obj->type) {
+        obj->type = header->type;
+    }
+
+    const uint64_t properties_count = header->properties_count;
+
+    uint8_t *tables = (uint8_t *) (header + 1);
+    uint64_t *keys = (uint64_t *) tables;
+    uint64_t *offset = keys + properties_count + 1;
+    uint8_t *ptype = (uint8_t *) (offset + properties_count + 1);
+    uint8_t *values = tables + _binobj_tables_size(properties_count);
+    char *strbuffer = (char *) (values + _align8(header->values_size));
+    char *subobject_buffer = strbuffer + header->string_buffer_size;
+    char *blob_buffer = subobject_buffer + header->subobject_buffer_size;
+
+    if (!properties_count) {
+        _index_object(obj);
+        return;
+    }
+
+    struct ct_alloc *a = _G.allocator;
+
+    // Loaded resources are mostly only read, load it frozen in place
+    // if possible.
+    const uint64_t first_prop = obj->layout->properties_count;
+    const bool in_place = first_prop == 1;
+
+    if (in_place) {
+        _object_freeze(obj, image, tables, properties_count,
+                       header->values_size, a);
+    } else {
+        _object_make_mutable(obj, a);
+        struct object_layout_t *layout = obj->layout;
+
+        const uint64_t values_offset = layout->values_size;
+
+        ct_array_push_n(layout->keys, keys + 1, properties_count, a);
+        ct_array_push_n(layout->property_type, ptype + 1,
+                        properties_count, a);
+
+        for (int i = 1; i <= properties_count; ++i) {
+            ct_array_push(layout->offset, values_offset + offset[i], a);
+        }
+
+        ct_array_push_n(obj->values, values, header->values_size, a);
+
+        layout->properties_count += properties_count;
+        layout->values_size += header->values_size;
+
+        for (int i = first_prop; i < layout->properties_count; ++i) {
+            ct_hash_add(&layout->prop_map, layout->keys[i], i, a);
+        }
+    }
+
+    // Relocate offsets in values, in place values point to image.
+    struct object_layout_t *layout = obj->layout;
+    for (int i = first_prop; i < layout->properties_count; ++i) {
+        union type_u *value_ptr = (union type_u *) (obj->values +
+                                                    layout->offset[i]);
+
+        switch (layout->property_type[i]) {
+            case CDB_TYPE_SUBOBJECT: {
+                uint64_t suboffset = value_ptr->subobj;
+
+                uint64_t subobj = create_object(db, 0);
+                _load(obj->db, image, subobject_buffer + suboffset, subobj);
+
+                struct object_t *sub_obj = _get_object_from_objid(subobj);
+                sub_obj->parent = _obj;
+
+                value_ptr->subobj = subobj;
+            }
+
+                break;
+
+            case CDB_TYPE_STR: {
+                char *str = strbuffer + value_ptr->uint64;
+
+                value_ptr->str = in_place ? str : _str_intern(str);
+            }
+
+                break;
+
+            case CDB_TYPE_BLOB: {
+                char *blob = blob_buffer + value_ptr->uint64;
+
+                uint64_t size = *((uint64_t *) blob);
+                char *blob_data = blob + sizeof(uint64_t);
+
+                if (!in_place) {
+                    blob_data = _blob_new(blob_data, size);
+                }
+
+                value_ptr->blob.size = size;
+                value_ptr->blob.data = blob_data;
+            }
+                break;
+            default:
+                break;
+        }
+
+    }
+
+    _index_object(obj);
+}
+
+static void load(struct ct_cdb_t db,
+                 char *input,
+                 uint64_t _obj,
+                 struct ct_alloc *allocator) {
+    const struct cdb_binobj_header *header;
+    header = (const struct cdb_binobj_header *) input;
+
+    if (header->version != CDB_BINOBJ_VERSION) {
+        ct_log_a0->error(LOG_WHERE, "Invalid binary object version %llu",
+                         (unsigned long long) header->version);
+
+        CT_FREE(allocator, input);
+        return;
+    }
+
+    struct image_t *image = CT_ALLOC(_G.allocator, struct image_t,
+                                     sizeof(struct image_t));
+
+    *image = (struct image_t) {
+            .data = input,
+            .size = _binobj_size(header),
+            .allocator = allocator,
+    };
+
+    atomic_init(&image->refcount, 1);
+
+    _load(db, image, input, _obj);
+
+    // Input is freed here if nothing was loaded in place.
+    _image_release(image);
+}
+
+static int _image_entry_cmp(const void *a,
+                            const void *b) {
+    const uint64_t ka = ((const struct cdb_image_entry *) a)->key;
+    const uint64_t kb = ((const struct cdb_image_entry *) b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+static bool _image_write(struct ct_vio *f,
+                         const void *data,
+                         uint64_t size) {
+    return !size || (f->write(f, data, size, 1) == 1);
+}
+
+static bool save_image(const char *path,
+                       const struct ct_cdb_image_entry_t *entries,
+                       uint32_t entries_count) {
+    struct ct_alloc *a = _G.allocator;
+
+    struct cdb_image_entry *table = NULL;
+    char *data = NULL;
+
+    for (uint32_t i = 0; i < entries_count; ++i) {
+        const uint64_t offset = ct_array_size(data);
+        dump(entries[i].obj, &data, a);
+
+        struct cdb_image_entry entry = {
+                .key = entries[i].key,
+                .source_hash = entries[i].source_hash,
+                .offset = offset,
+                .size = ct_array_size(data) - offset,
+        };
+
+        ct_array_push(table, entry, a);
+    }
+
+    if (entries_count) {
+        qsort(table, entries_count, sizeof(struct cdb_image_entry),
+              _image_entry_cmp);
+    }
+
+    struct cdb_image_header header = {
+            .magic = CDB_IMAGE_MAGIC,
+            .version = CDB_IMAGE_VERSION,
+            .binobj_version = CDB_BINOBJ_VERSION,
+            .entries_count = entries_count,
+            .data_size = ct_array_size(data),
+    };
+
+    // Old image can be mapped, write new file and replace it by rename.
+    // Truncating mapped file would crash objects that use it.
+    char *tmp_path = NULL;
+    ct_array_push_n(tmp_path, path, strlen(path), a);
+    ct_array_push_n(tmp_path, ".tmp", sizeof(".tmp"), a);
+
+    bool ok = false;
+    struct ct_vio *f = ct_os_a0->vio->from_file(tmp_path, VIO_OPEN_WRITE);
+    if (f) {
+        ok = _image_write(f, &header, sizeof(header)) &&
+             _image_write(f, table, sizeof(*table) * entries_count) &&
+             _image_write(f, data, header.data_size);
+
+        f->close(f);
+
+        ok = ok && !rename(tmp_path, path);
+
+        if (!ok) {
+            remove(tmp_path);
+        }
+    }
+
+    if (!ok) {
+        ct_log_a0->error(LOG_WHERE, "Could not write image %s", path);
+    }
+
+    ct_array_free(tmp_path, a);
+    ct_array_free(table, a);
+    ct_array_free(data, a);
+
+    return ok;
+}
+
+static bool _image_header_valid(const struct cdb_image_header *header,
+                                uint64_t size) {
+    if ((size < sizeof(struct cdb_image_header)) ||
+        (header->magic != CDB_IMAGE_MAGIC) ||
+        (header->version != CDB_IMAGE_VERSION) ||
+        (header->binobj_version != CDB_BINOBJ_VERSION)) {
+        return false;
+    }
+
+    size -= sizeof(struct cdb_image_header);
+
+    const uint64_t max_entries = size / sizeof(struct cdb_image_entry);
+    if (header->entries_count > max_entries) {
+        return false;
+    }
+
+    size -= header->entries_count * sizeof(struct cdb_image_entry);
+
+    return header->data_size <= size;
+}
+
+static const struct cdb_image_entry *_image_find(
+        const struct cdb_image_entry *table,
+        uint64_t n,
+        uint64_t key) {
+    uint64_t first = 0;
+    uint64_t count = n;
+
+    while (count) {
+        const uint64_t half = count / 2;
+
+        if (table[first + half].key < key) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+
+    return ((first < n) && (table[first].key == key)) ? &table[first] : NULL;
+}
+
+static uint32_t load_image(struct ct_cdb_t db,
+                           const char *path,
+                           struct ct_cdb_image_entry_t *entries,
+                           uint32_t entries_count) {
+    for (uint32_t i = 0; i < entries_count; ++i) {
+        entries[i].obj = 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+
+    // Private mapping, relocating loaded values copy only touched pages.
+    // Pages of objects that are not loaded are never read.
+    char *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    struct image_t *image = CT_ALLOC(_G.allocator, struct image_t,
+                                     sizeof(struct image_t));
+
+    *image = (struct image_t) {
+            .data = data,
+            .size = st.st_size,
+            .mapped = true,
+    };
+
+    atomic_init(&image->refcount, 1);
+
+    const struct cdb_image_header *header;
+    header = (const struct cdb_image_header *) data;
+
+    if (!_image_header_valid(header, image->size)) {
+        ct_log_a0->warning(LOG_WHERE, "Invalid image %s", path);
+
+        _image_release(image);
+        return 0;
+    }
+
+    const struct cdb_image_entry *table;
+    table = (const struct cdb_image_entry *) (header + 1);
+
+    char *objects = (char *) (table + header->entries_count);
+
+    uint32_t loaded = 0;
+    for (uint32_t i = 0; i < entries_count; ++i) {
+        const struct cdb_image_entry *entry;
+        entry = _image_find(table, header->entries_count, entries[i].key);
+
+        // Source changed or is new, caller must import it.
+        if (!entry || (entry->source_hash != entries[i].source_hash)) {
+            continue;
+        }
+
+        if ((entry->offset > header->data_size) ||
+            (entry->size > (header->data_size - entry->offset)) ||
+            (entry->size < sizeof(struct cdb_binobj_header))) {
+            continue;
+        }
+
+        char *input = objects + entry->offset;
+        if (_binobj_size((struct cdb_binobj_header *) input) > entry->size) {
+            continue;
+        }
+
+        entries[i].obj = create_object(db, 0);
+        _load(db, image, input, entries[i].obj);
+
+        ++loaded;
     }
+
+    // Unmapped here if nothing was loaded.
+    _image_release(image);
+
+    return loaded;
 }
 
-struct cdb_binobj_header {
-    uint64_t version;
-    uint64_t type;
-    uint64_t properties_count;
-    uint64_t values_size;
-    uint64_t string_buffer_size;
-    uint64_t subobject_buffer_size;
-    uint64_t blob_buffer_size;
-};
+static __thread struct writer_t *_free_writers;
+static __thread uint32_t _free_writers_n;
 
-static void dump(uint64_t _obj,
-                 char **output,
-                 struct ct_alloc *allocator) {
-    struct object_t *obj = _get_object_from_objid(_obj);
+static struct writer_t *_new_writer() {
+    struct writer_t *writer = _free_writers;
 
-    uint64_t *keys = obj->keys;
-    uint8_t *type = obj->property_type;
-    uint64_t *offset = obj->offset;
-    uint8_t *values = obj->values;
+    if (writer) {
+        _free_writers = writer->next;
+        --_free_writers_n;
+        return writer;
+    }
 
-    uint8_t *values_copy = CT_ALLOC(allocator, uint8_t, ct_array_size(values));
-    memcpy(values_copy, values, ct_array_size(values));
+    writer = CT_ALLOC(_G.allocator, struct writer_t, sizeof(struct writer_t));
+    *writer = (struct writer_t) {0};
 
-    char *str_buffer = NULL;
-    char *subobject_buffer = NULL;
-    char *blob_buffer = NULL;
-    for (int i = 1; i < obj->properties_count; ++i) {
-        switch (obj->property_type[i]) {
-            case CDB_TYPE_SUBOBJECT: {
-                uint64_t subobject_offset = ct_array_size(subobject_buffer);
-                uint64_t subobject_ptr;
+    return writer;
+}
 
-                union type_u *value_ptr = (union type_u *) (values_copy +
-                                                            offset[i]);
-                subobject_ptr = value_ptr->subobj;
+static void _free_writer(struct writer_t *writer) {
+    if (_free_writers_n >= MAX_FREE_WRITERS) {
+        ct_hash_free(&writer->prop_map, _G.allocator);
+        ct_array_free(writer->props, _G.allocator);
+        ct_array_free(writer->values, _G.allocator);
+        ct_array_free(writer->changed_prop, _G.allocator);
+        ct_array_free(writer->garbage, _G.allocator);
 
-                dump(subobject_ptr, &subobject_buffer, allocator);
+        CT_FREE(_G.allocator, writer);
+        return;
+    }
 
-                uint64_t *ptr = (uint64_t *) (values_copy + offset[i]);
-                *ptr = subobject_offset;
-            }
+    ct_hash_clean(&writer->prop_map);
+    ct_array_clean(writer->props);
+    ct_array_clean(writer->values);
+    ct_array_clean(writer->changed_prop);
+    ct_array_clean(writer->garbage);
+
+    *writer = (struct writer_t) {
+            .next = _free_writers,
+            .prop_map = writer->prop_map,
+            .props = writer->props,
+            .values = writer->values,
+            .changed_prop = writer->changed_prop,
+            .garbage = writer->garbage,
+    };
 
-                break;
+    _free_writers = writer;
+    ++_free_writers_n;
+}
 
-            case CDB_TYPE_STR: {
-                uint64_t stroffset = ct_array_size(str_buffer);
-                char *str = *(char **) (values_copy + offset[i]);
-                ct_array_push_n(str_buffer, str, strlen(str) + 1, allocator);
+// Release str/blob owned by changed property.
+static void _writer_release_value(struct writer_t *writer,
+                                  struct writer_prop_t *prop) {
+    union type_u *value_ptr = (union type_u *) (writer->values +
+                                                prop->offset);
 
-                uint64_t *strptr = (uint64_t *) (values_copy + offset[i]);
-                *strptr = stroffset;
+    switch (prop->type) {
+        case CDB_TYPE_STR:
+            _rc_release(value_ptr->str);
+            break;
+
+        case CDB_TYPE_BLOB:
+            _rc_release(value_ptr->blob.data);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Release str/blob data owned by writer that was not commited.
+static void _writer_free_values(struct writer_t *writer) {
+    const uint32_t props_n = ct_array_size(writer->props);
+
+    for (int i = 0; i < props_n; ++i) {
+        _writer_release_value(writer, &writer->props[i]);
+    }
+}
+
+// Return value of changed property in writer.
+static union type_u *_writer_prop(struct writer_t *writer,
+                                  uint64_t key,
+                                  enum ct_cdb_type type,
+                                  size_t size) {
+    struct ct_alloc *a = _G.allocator;
+
+    uint64_t idx = ct_hash_lookup(&writer->prop_map, key, UINT64_MAX);
+
+    if (UINT64_MAX == idx) {
+        ct_array_push(writer->changed_prop, key, a);
+
+        idx = ct_array_size(writer->props);
+        ct_array_push(writer->props, (struct writer_prop_t) {.key = key}, a);
+        ct_hash_add(&writer->prop_map, key, idx, a);
+    }
+
+    struct writer_prop_t *prop = &writer->props[idx];
+
+    // Property set again in same writer.
+    _writer_release_value(writer, prop);
+
+    if (prop->size < size) {
+        prop->offset = ct_array_size(writer->values);
+        ct_array_resize(writer->values, prop->offset + size, a);
+    }
+
+    prop->type = type;
+    prop->size = size;
+
+    return (union type_u *) (writer->values + prop->offset);
+}
+
+// Build new version from orig version and writer changes.
+static struct object_t *_writer_apply(struct writer_t *writer,
+                                      uint64_t orig_version) {
+    struct ct_alloc *a = _G.allocator;
+
+    struct object_t *orig = _get_object_from_version(orig_version);
+    struct db_t *db_inst = &_G.dbs[orig->db.idx];
+
+    struct object_t *obj = _object_new_version(db_inst, orig, a);
+
+    if (writer->parent) {
+        obj->parent = writer->parent;
+    }
+
+    const uint32_t props_n = ct_array_size(writer->props);
+    for (int i = 0; i < props_n; ++i) {
+        struct writer_prop_t *prop = &writer->props[i];
+
+        uint64_t idx = _find_prop_index(obj, prop->key);
+        const bool exist = idx > 0;
+
+        if (!exist) {
+            idx = _object_new_property(obj, prop->key, prop->type,
+                                       prop->size, a);
+        }
+
+        union type_u *value_ptr;
+        value_ptr = (union type_u *) (obj->values + obj->layout->offset[idx]);
+
+        if (exist) {
+            const enum ct_cdb_type old_type = (enum ct_cdb_type) \
+                    obj->layout->property_type[idx];
+
+            switch (old_type) {
+                case CDB_TYPE_STR:
+                    if (!_image_contains(obj->image, value_ptr->str)) {
+                        ct_array_push(writer->garbage, value_ptr->str, a);
+                    }
+                    break;
+
+                case CDB_TYPE_BLOB:
+                    if (!_image_contains(obj->image, value_ptr->blob.data)) {
+                        ct_array_push(writer->garbage, value_ptr->blob.data,
+                                      a);
+                    }
+                    break;
+
+                default:
+                    break;
             }
-                break;
 
-            case CDB_TYPE_BLOB: {
-                uint64_t bloboffset = ct_array_size(blob_buffer);
+            if (old_type != prop->type) {
+                _object_retype_property(obj, idx, prop->type, prop->size, a);
+                value_ptr = (union type_u *) (obj->values +
+                                              obj->layout->offset[idx]);
+            }
+        }
 
-                struct blob_t *blob;
-                blob = (struct blob_t *) (values_copy + offset[i]);
+        memcpy(value_ptr, writer->values + prop->offset, prop->size);
+    }
 
-                ct_array_push_n(blob_buffer, &blob->size, sizeof(uint64_t),
-                                allocator);
+    return obj;
+}
 
-                ct_array_push_n(blob_buffer, blob->data, blob->size, allocator);
+// Orig version is unreachable, replaced data is freed with it.
+static void _writer_retire(struct writer_t *writer,
+                           uint64_t orig_version) {
+    struct object_t *orig = _get_object_from_version(orig_version);
 
-                uint64_t *blobptr = (uint64_t *) (values_copy + offset[i]);
-                *blobptr = bloboffset;
+    const uint32_t garbage_n = ct_array_size(writer->garbage);
+    if (garbage_n) {
+        ct_array_push_n(orig->garbage, writer->garbage, garbage_n,
+                        _G.allocator);
+    }
+
+    _destroy_object(orig);
+}
+
+static ct_cdb_obj_o *write_begin(uint64_t _obj) {
+    struct writer_t *writer = _new_writer();
+
+    writer->obj = _obj;
+    writer->orig_version = atomic_load((atomic_ullong *) _obj);
+
+    return writer;
+}
+
+static void _notify(uint64_t _obj,
+                    uint64_t *changed_prop) {
+    struct object_t *obj = _get_object_from_objid(_obj);
+
+    // Instance cache contain values from changed prefab.
+    _object_invalidate_resolved(obj);
+
+    const int notify_n = ct_array_size(obj->notify);
+    const int changed_prop_n = ct_array_size(changed_prop);
+
+    for (int i = 0; i < notify_n; ++i) {
+        struct notify_pair *pair = &obj->notify[i];
+
+        if (pair->notify_batch) {
+            struct ct_cdb_change_t change = {
+                    .obj = _obj,
+                    .prop = changed_prop,
+                    .prop_count = changed_prop_n,
+            };
+
+            pair->notify_batch(&change, 1, pair->data);
+        } else {
+            pair->notify(_obj, changed_prop, changed_prop_n, pair->data);
+        }
+    }
+
+    struct instances_t *instances = _instances(_obj);
+    const uint32_t instances_n = _instances_n(instances);
+    for (uint32_t i = 0; i < instances_n; ++i) {
+        _notify(_instances_get(instances, i), changed_prop);
+    }
+}
+
+static struct notify_change_t *_notify_change(struct notify_changes_t *c,
+                                              uint64_t obj) {
+    const uint64_t key = _objid_key(obj);
+    uint64_t idx = ct_hash_lookup(&c->obj_map, key, UINT64_MAX);
+
+    if (UINT64_MAX == idx) {
+        idx = ct_array_size(c->changes);
+
+        ct_array_push(c->changes, (struct notify_change_t) {.obj = obj},
+                      _G.allocator);
+
+        ct_hash_add(&c->obj_map, key, idx, _G.allocator);
+    }
+
+    return &c->changes[idx];
+}
+
+// Add props missing in change, return count of added props at end.
+static uint32_t _notify_change_merge(struct notify_change_t *change,
+                                     const uint64_t *prop,
+                                     uint32_t prop_n) {
+    const uint32_t first = ct_array_size(change->prop);
+
+    for (uint32_t i = 0; i < prop_n; ++i) {
+        const uint32_t n = ct_array_size(change->prop);
+
+        uint32_t j = 0;
+        while ((j < n) && (change->prop[j] != prop[i])) {
+            ++j;
+        }
+
+        if (j == n) {
+            ct_array_push(change->prop, prop[i], _G.allocator);
+        }
+    }
+
+    return ct_array_size(change->prop) - first;
+}
+
+static void _notify_changes_free(struct notify_changes_t *c) {
+    const uint32_t changes_n = ct_array_size(c->changes);
+    for (uint32_t i = 0; i < changes_n; ++i) {
+        ct_array_free(c->changes[i].prop, _G.allocator);
+    }
+
+    ct_array_free(c->changes, _G.allocator);
+    ct_hash_free(&c->obj_map, _G.allocator);
+}
+
+// Change of prefab is change of its instances. Instances get only props
+// new for prefab, so object reached from more changes is expanded once
+// per prop.
+static void _notify_expand(struct notify_changes_t *c,
+                           uint64_t _obj,
+                           const uint64_t *prop,
+                           uint32_t prop_n) {
+    struct notify_change_t *change = _notify_change(c, _obj);
+    const uint64_t change_idx = change - c->changes;
+
+    const uint32_t added = _notify_change_merge(change, prop, prop_n);
+    if (!added) {
+        return;
+    }
+
+    struct instances_t *instances = _instances(_obj);
+    const uint32_t instances_n = _instances_n(instances);
+    for (uint32_t i = 0; i < instances_n; ++i) {
+        change = &c->changes[change_idx];
+
+        const uint32_t n = ct_array_size(change->prop);
+        _notify_expand(c, _instances_get(instances, i),
+                       change->prop + (n - added), added);
+    }
+}
+
+// Changes for one handler.
+struct notify_group_t {
+    struct notify_pair pair;
+    struct ct_cdb_change_t *changes;
+};
+
+static struct notify_group_t *_notify_group(struct notify_group_t **groups,
+                                            const struct notify_pair *pair) {
+    const uint32_t groups_n = ct_array_size(*groups);
+
+    for (uint32_t i = 0; i < groups_n; ++i) {
+        struct notify_group_t *group = &(*groups)[i];
+
+        if ((group->pair.notify == pair->notify) &&
+            (group->pair.notify_batch == pair->notify_batch) &&
+            (group->pair.data == pair->data)) {
+            return group;
+        }
+    }
+
+    ct_array_push(*groups, (struct notify_group_t) {.pair = *pair},
+                  _G.allocator);
+
+    return &(*groups)[groups_n];
+}
+
+static void flush_notify() {
+    ct_os_a0->thread->spin_lock(&_G.notify_lock);
+    struct notify_changes_t queue = _G.notify_queue;
+    _G.notify_queue = (struct notify_changes_t) {};
+    ct_os_a0->thread->spin_unlock(&_G.notify_lock);
+
+    _epoch_enter();
+
+    struct notify_changes_t changes = {};
+
+    const uint32_t queue_n = ct_array_size(queue.changes);
+    for (uint32_t i = 0; i < queue_n; ++i) {
+        struct notify_change_t *change = &queue.changes[i];
+
+        _notify_expand(&changes, change->obj, change->prop,
+                       ct_array_size(change->prop));
+    }
+
+    struct notify_group_t *groups = NULL;
+
+    const uint32_t changes_n = ct_array_size(changes.changes);
+    for (uint32_t i = 0; i < changes_n; ++i) {
+        struct notify_change_t *change = &changes.changes[i];
+        struct object_t *obj = _get_object_from_objid(change->obj);
+
+        const struct ct_cdb_change_t c = {
+                .obj = change->obj,
+                .prop = change->prop,
+                .prop_count = ct_array_size(change->prop),
+        };
+
+        const uint32_t notify_n = ct_array_size(obj->notify);
+        for (uint32_t j = 0; j < notify_n; ++j) {
+            struct notify_group_t *group = _notify_group(&groups,
+                                                         &obj->notify[j]);
+
+            ct_array_push(group->changes, c, _G.allocator);
+        }
+    }
+
+    const uint32_t groups_n = ct_array_size(groups);
+    for (uint32_t i = 0; i < groups_n; ++i) {
+        struct notify_pair *pair = &groups[i].pair;
+        struct ct_cdb_change_t *group_changes = groups[i].changes;
+
+        const uint32_t n = ct_array_size(group_changes);
+
+        if (pair->notify_batch) {
+            pair->notify_batch(group_changes, n, pair->data);
+        } else {
+            for (uint32_t j = 0; j < n; ++j) {
+                struct ct_cdb_change_t *c = &group_changes[j];
+                pair->notify(c->obj, c->prop, c->prop_count, pair->data);
             }
-                break;
-            default:
-                break;
         }
+
+        ct_array_free(groups[i].changes, _G.allocator);
     }
 
-    struct cdb_binobj_header header = {
-            .type = obj->type,
-            .properties_count = obj->properties_count - 1,
-            .values_size = ct_array_size(values),
-            .string_buffer_size = ct_array_size(str_buffer),
-            .subobject_buffer_size = ct_array_size(subobject_buffer),
-            .blob_buffer_size = ct_array_size(blob_buffer),
-    };
+    ct_array_free(groups, _G.allocator);
 
-    ct_array_push_n(*output, (char *) &header,
-                    sizeof(struct cdb_binobj_header),
-                    allocator);
+    _epoch_exit();
 
-    ct_array_push_n(*output, (char *) (keys + 1),
-                    sizeof(uint64_t) * (ct_array_size(keys) - 1),
-                    allocator);
+    _notify_changes_free(&changes);
+    _notify_changes_free(&queue);
+}
 
-    ct_array_push_n(*output, (char *) (type + 1),
-                    sizeof(uint8_t) * (ct_array_size(type) - 1),
-                    allocator);
+static void set_notify_deferred(bool deferred) {
+    atomic_store(&_G.notify_deferred, deferred);
 
-    ct_array_push_n(*output, (char *) (offset + 1),
-                    sizeof(uint64_t) * (ct_array_size(offset) - 1),
-                    allocator);
+    if (!deferred) {
+        flush_notify();
+    }
+}
 
-    ct_array_push_n(*output, (char *) values_copy,
-                    ct_array_size(values),
-                    allocator);
+static void _invalidate_resolved(uint64_t _obj);
 
-    ct_array_push_n(*output, (char *) str_buffer,
-                    header.string_buffer_size,
-                    allocator);
+static void _notify_commit(uint64_t obj,
+                           uint64_t *changed_prop) {
+    if (!atomic_load_explicit(&_G.notify_deferred, memory_order_relaxed)) {
+        _notify(obj, changed_prop);
+        return;
+    }
 
-    ct_array_push_n(*output, (char *) subobject_buffer,
-                    header.subobject_buffer_size,
-                    allocator);
+    // Instances must not read old prefab values until flush.
+    _invalidate_resolved(obj);
 
-    ct_array_push_n(*output, (char *) blob_buffer,
-                    header.blob_buffer_size,
-                    allocator);
+    ct_os_a0->thread->spin_lock(&_G.notify_lock);
 
-    CT_FREE(allocator, values_copy);
+    struct notify_change_t *change = _notify_change(&_G.notify_queue, obj);
+    _notify_change_merge(change, changed_prop, ct_array_size(changed_prop));
+
+    ct_os_a0->thread->spin_unlock(&_G.notify_lock);
 }
 
-static void load(struct ct_cdb_t db,
-                 const char *input,
-                 uint64_t _obj,
-                 struct ct_alloc *allocator) {
+static struct changelog_entry_t *_changelog_entry(struct db_t *db_inst,
+                                                  uint64_t number) {
+    if (number <= db_inst->changelog_first) {
+        return NULL;
+    }
 
-    const struct cdb_binobj_header *header;
-    header = (const struct cdb_binobj_header *) input;
+    return &db_inst->changelog[number - db_inst->changelog_first - 1];
+}
 
+// Log keep own reference of str and blob, values in image are copied.
+static void _changelog_retain(struct object_t *obj,
+                              enum ct_cdb_type type,
+                              union ct_cdb_value_t *value) {
+    switch (type) {
+        case CDB_TYPE_STR:
+            if (_image_contains(obj->image, value->str)) {
+                value->str = _str_intern(value->str);
+            } else {
+                _rc_retain((void *) value->str);
+            }
+            break;
+
+        case CDB_TYPE_BLOB:
+            if (_image_contains(obj->image, value->blob.data)) {
+                value->blob.data = _blob_new(value->blob.data,
+                                             value->blob.size);
+            } else {
+                _rc_retain(value->blob.data);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void _changelog_release(enum ct_cdb_type type,
+                               union ct_cdb_value_t *value) {
+    switch (type) {
+        case CDB_TYPE_STR:
+            _rc_release((void *) value->str);
+            break;
+
+        case CDB_TYPE_BLOB:
+            _rc_release(value->blob.data);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Lock changelog of object db for commit, NULL if db has no changelog.
+// Commits are logged in order they are visible.
+static struct db_t *_changelog_begin(uint64_t _obj) {
     struct object_t *obj = _get_object_from_objid(_obj);
-    if (!obj->type) {
-        obj->type = header->type;
+    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+
+    if (!atomic_load_explicit(&db_inst->changelog_enabled,
+                              memory_order_relaxed)) {
+        return NULL;
+    }
+
+    ct_os_a0->thread->spin_lock(&db_inst->changelog_lock);
+    return db_inst;
+}
+
+// Log commited writer if any and unlock.
+static void _changelog_end(struct db_t *db_inst,
+                           struct writer_t *writer,
+                           uint64_t orig_version) {
+    if (!db_inst) {
+        return;
+    }
+
+    if (writer) {
+        struct object_t *orig = _get_object_from_version(orig_version);
+        const uint64_t epoch = atomic_load(&db_inst->changelog_epoch) + 1;
+
+        const uint32_t props_n = ct_array_size(writer->props);
+        for (int i = 0; i < props_n; ++i) {
+            struct writer_prop_t *prop = &writer->props[i];
+
+            struct changelog_entry_t entry = {
+                    .change = {
+                            .epoch = epoch,
+                            .obj = writer->obj,
+                            .prop = prop->key,
+                            .new_type = (enum ct_cdb_type) prop->type,
+                    },
+                    .prev = ct_hash_lookup(&db_inst->changelog_last,
+                                           _objid_key(writer->obj), 0),
+            };
+
+            struct ct_cdb_prop_change_t *change = &entry.change;
+
+            const uint64_t idx = _find_prop_index(orig, prop->key);
+            if (idx) {
+                change->old_type = \
+                    (enum ct_cdb_type) orig->layout->property_type[idx];
+
+                memcpy(&change->old_value,
+                       orig->values + orig->layout->offset[idx],
+                       _type_size[change->old_type]);
+
+                _changelog_retain(orig, change->old_type,
+                                  &change->old_value);
+            }
+
+            memcpy(&change->new_value, writer->values + prop->offset,
+                   _type_size[change->new_type]);
+
+            _changelog_retain(orig, change->new_type, &change->new_value);
+
+            ct_array_push(db_inst->changelog, entry, _G.allocator);
+
+            const uint64_t number = db_inst->changelog_first +
+                                    ct_array_size(db_inst->changelog);
+
+            ct_hash_add(&db_inst->changelog_last, _objid_key(writer->obj),
+                        number, _G.allocator);
+        }
+
+        atomic_store(&db_inst->changelog_epoch, epoch);
+    }
+
+    ct_os_a0->thread->spin_unlock(&db_inst->changelog_lock);
+}
+
+static void set_changelog(struct ct_cdb_t db,
+                          bool enabled) {
+    atomic_store(&_G.dbs[db.idx].changelog_enabled, enabled);
+}
+
+static uint64_t snapshot(struct ct_cdb_t db) {
+    return atomic_load(&_G.dbs[db.idx].changelog_epoch);
+}
+
+static uint32_t changes(struct ct_cdb_t db,
+                        uint64_t since,
+                        struct ct_cdb_prop_change_t *changes,
+                        uint32_t max) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
+
+    ct_os_a0->thread->spin_lock(&db_inst->changelog_lock);
+
+    // Entries are sorted by epoch.
+    uint32_t first = 0;
+    uint32_t last = ct_array_size(db_inst->changelog);
+    while (first < last) {
+        const uint32_t mid = first + ((last - first) / 2);
+
+        if (db_inst->changelog[mid].change.epoch <= since) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
     }
 
-    uint64_t *keys = (uint64_t *) (header + 1);
-    uint8_t *ptype = (uint8_t *) (keys + header->properties_count);
-    uint64_t *offset = (uint64_t *) (ptype + header->properties_count);
-    uint8_t *values = (uint8_t *) (offset + header->properties_count);
-    const char *strbuffer = (char *) (values + header->values_size);
-    const char *subobject_buffer = (char *) (strbuffer +
-                                             header->string_buffer_size);
-    const char *blob_buffer = (char *) (subobject_buffer +
-                                        header->subobject_buffer_size);
-    if (!header->properties_count) {
-        return;
+    const uint32_t n = ct_array_size(db_inst->changelog) - first;
+    const uint32_t copy_n = n < max ? n : max;
+
+    for (uint32_t i = 0; i < copy_n; ++i) {
+        changes[i] = db_inst->changelog[first + i].change;
     }
 
-    ct_array_push_n(obj->keys, keys,
-                    header->properties_count,
-                    allocator);
+    ct_os_a0->thread->spin_unlock(&db_inst->changelog_lock);
 
-    ct_array_push_n(obj->property_type, ptype,
-                    header->properties_count,
-                    allocator);
+    return n;
+}
 
-    ct_array_push_n(obj->offset, offset,
-                    header->properties_count,
-                    allocator);
+static enum ct_cdb_type read_at(uint64_t _obj,
+                                uint64_t snapshot,
+                                uint64_t prop,
+                                union ct_cdb_value_t *value) {
+    _epoch_enter();
 
-    ct_array_push_n(obj->values, values,
-                    header->values_size,
-                    allocator);
+    struct object_t *obj = _get_object_from_objid(_obj);
+    struct db_t *db_inst = &_G.dbs[obj->db.idx];
 
-    obj->properties_count += header->properties_count;
+    ct_os_a0->thread->spin_lock(&db_inst->changelog_lock);
 
-    for (int i = 1; i < obj->properties_count; ++i) {
-        ct_hash_add(&obj->prop_map, obj->keys[i], i, allocator);
-    }
+    // Oldest change after snapshot has value from snapshot.
+    struct ct_cdb_prop_change_t *oldest = NULL;
 
-    for (int i = 1; i < obj->properties_count; ++i) {
-        switch (obj->property_type[i]) {
-            case CDB_TYPE_SUBOBJECT: {
-                uint64_t suboffset = *(uint64_t *) (obj->values +
-                                                    obj->offset[i]);
+    uint64_t number = ct_hash_lookup(&db_inst->changelog_last,
+                                     _objid_key(_obj), 0);
+    struct changelog_entry_t *entry;
+    while ((entry = _changelog_entry(db_inst, number))) {
+        if (entry->change.epoch <= snapshot) {
+            break;
+        }
 
-                const char *subobj_data;
-                subobj_data = subobject_buffer + suboffset;
+        if (entry->change.prop == prop) {
+            oldest = &entry->change;
+        }
 
-                uint64_t subobj = create_object(db, 0);
-                load(obj->db, subobj_data, subobj, allocator);
+        number = entry->prev;
+    }
 
-                struct object_t *sub_obj = _get_object_from_objid(subobj);
-                sub_obj->parent = _obj;
+    enum ct_cdb_type type = CDB_TYPE_NONE;
 
-                union type_u *value_ptr = (union type_u *) (obj->values +
-                                                            obj->offset[i]);
-                value_ptr->subobj = subobj;
-            }
+    if (oldest) {
+        type = oldest->old_type;
+        *value = oldest->old_value;
+    } else {
+        // Current version under lock, no commit is logged meanwhile.
+        obj = _get_object_from_objid(_obj);
+
+        const uint64_t idx = _find_prop_index(obj, prop);
+        if (idx) {
+            type = (enum ct_cdb_type) obj->layout->property_type[idx];
+            memcpy(value, obj->values + obj->layout->offset[idx],
+                   _type_size[type]);
+        }
+    }
 
-                break;
+    ct_os_a0->thread->spin_unlock(&db_inst->changelog_lock);
 
-            case CDB_TYPE_STR: {
-                uint64_t str_offset = *(uint64_t *) (obj->values +
-                                                     obj->offset[i]);
+    // Not own at snapshot, value is inherited from prefab.
+    if ((type == CDB_TYPE_NONE) && obj->prefab) {
+        type = read_at(obj->prefab, snapshot, prop, value);
 
-                char *dup_str = ct_memory_a0->str_dup(strbuffer + str_offset,
-                                                      allocator);
+        // Inherited subobject is read through own instance of it.
+        if ((type == CDB_TYPE_SUBOBJECT) && value->subobject) {
+            obj = _get_object_from_objid(_obj);
 
-                union type_u *value_ptr = (union type_u *) (obj->values +
-                                                            obj->offset[i]);
-                value_ptr->str = dup_str;
+            if (!_find_prop_index(obj, prop)) {
+                value->subobject = read_subobject(_obj, prop, 0);
             }
+        }
+    }
 
-                break;
+    _epoch_exit();
 
-            case CDB_TYPE_BLOB: {
-                uint64_t blob_offset = *(uint64_t *) (obj->values +
-                                                      obj->offset[i]);
+    return type;
+}
+
+static void trim_changelog(struct ct_cdb_t db,
+                           uint64_t snapshot) {
+    struct db_t *db_inst = &_G.dbs[db.idx];
 
-                uint64_t size = *((uint64_t *) (blob_buffer + blob_offset));
-                const char *blob_data = ((blob_buffer +
-                                          blob_offset + sizeof(uint64_t)));
+    ct_os_a0->thread->spin_lock(&db_inst->changelog_lock);
 
-                char *copy_blob_data = CT_ALLOC(allocator, char, size);
-                memcpy(copy_blob_data, blob_data, size);
+    const uint32_t n = ct_array_size(db_inst->changelog);
 
-                union type_u *value_ptr = (union type_u *) (obj->values +
-                                                            obj->offset[i]);
-                value_ptr->blob.size = size;
-                value_ptr->blob.data = copy_blob_data;
-            }
-                break;
-            default:
-                break;
+    uint32_t trim_n = 0;
+    for (; trim_n < n; ++trim_n) {
+        struct ct_cdb_prop_change_t *c = &db_inst->changelog[trim_n].change;
+
+        if (c->epoch > snapshot) {
+            break;
         }
 
+        _changelog_release(c->old_type, &c->old_value);
+        _changelog_release(c->new_type, &c->new_value);
     }
+
+    if (trim_n == n) {
+        ct_hash_clean(&db_inst->changelog_last);
+    } else {
+        memmove(db_inst->changelog, db_inst->changelog + trim_n,
+                sizeof(struct changelog_entry_t) * (n - trim_n));
+    }
+
+    ct_array_resize(db_inst->changelog, n - trim_n, _G.allocator);
+    db_inst->changelog_first += trim_n;
+
+    ct_os_a0->thread->spin_unlock(&db_inst->changelog_lock);
 }
 
-static ct_cdb_obj_o *write_begin(uint64_t _obj) {
-    struct object_t *obj = _get_object_from_objid(_obj);
-    struct db_t *db_inst = &_G.dbs[obj->db.idx];
+static void write_commit(ct_cdb_obj_o *_writer) {
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    struct object_t *new_obj = _object_clone(db_inst,
-                                             obj,
-                                             _G.allocator);
-    new_obj->orig_data_idx = obj->idx;
+    atomic_ullong *obj_addr = (atomic_ullong *) writer->obj;
 
-    new_obj->obj = _obj;
+    _epoch_enter();
 
-    return (void *) new_obj->idx;
-}
+    struct db_t *changelog_db = _changelog_begin(writer->obj);
 
-static void _notify(uint64_t _obj,
-                    uint64_t *changed_prop) {
-    struct object_t *obj = _get_object_from_objid(_obj);
+    // Apply changes to actual version, other writers can commit meanwhile.
+    uint64_t orig_version = atomic_load(obj_addr);
+    while (true) {
+        struct object_t *new_obj = _writer_apply(writer, orig_version);
 
-    const int notify_n = ct_array_size(obj->notify);
-    const int changed_prop_n = ct_array_size(changed_prop);
+        if (atomic_compare_exchange_strong(obj_addr, &orig_version,
+                                           new_obj->idx)) {
+            break;
+        }
 
-    for (int i = 0; i < notify_n; ++i) {
-        struct notify_pair *pair = &obj->notify[i];
-        pair->notify(_obj, changed_prop, changed_prop_n, pair->data);
+        ct_array_clean(writer->garbage);
+        _destroy_object(new_obj);
     }
 
-    const int instances_n = ct_array_size(obj->instances);
-    for (int i = 0; i < instances_n; ++i) {
-        _notify(obj->instances[i], changed_prop);
-    }
-}
+    _changelog_end(changelog_db, writer, orig_version);
 
-static void write_commit(ct_cdb_obj_o *_writer) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-    struct object_t *orig_obj = _get_object_from_objid(writer->obj);
+    _writer_retire(writer, orig_version);
 
-    uint64_t *obj_addr = (uint64_t *) writer->obj;
+    _notify_commit(writer->obj, writer->changed_prop);
+    _index_update(writer->obj);
 
-    *obj_addr = writer->idx;
+    _epoch_exit();
 
-//    (*(struct object_t **) writer->obj) = writer;
+    _free_writer(writer);
+}
 
-    _notify(writer->obj, writer->changed_prop);
+// Change that readers can't observe (lazy instance of inherited subobject)
+// is commited without notify, changelog and index update.
+static bool _write_try_commit(struct writer_t *writer,
+                              bool notify) {
+    atomic_ullong *obj_addr = (atomic_ullong *) writer->obj;
+    uint64_t orig_version = writer->orig_version;
 
-    _destroy_object(orig_obj);
-}
+    _epoch_enter();
 
-static bool write_try_commit(ct_cdb_obj_o *_writer) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-    struct object_t *orig_obj = _get_object_from_objid(writer->obj);
+    struct db_t *changelog_db = notify ? _changelog_begin(writer->obj) : NULL;
 
-    uint64_t *obj_addr = (uint64_t *) writer->obj;
+    bool ok = false;
+    if (atomic_load(obj_addr) != orig_version) {
+        _changelog_end(changelog_db, NULL, 0);
+        goto end;
+    }
 
-    bool ok = atomic_compare_exchange_weak((atomic_ullong *) obj_addr,
-                                           &writer->orig_data_idx, writer->idx);
+    struct object_t *new_obj = _writer_apply(writer, orig_version);
+
+    ok = atomic_compare_exchange_strong(obj_addr, &orig_version,
+                                        new_obj->idx);
 
     if (!ok) {
+        _changelog_end(changelog_db, NULL, 0);
+        _destroy_object(new_obj);
         goto end;
     }
 
-    _notify(writer->obj, writer->changed_prop);
+    _changelog_end(changelog_db, writer, orig_version);
+
+    _writer_retire(writer, orig_version);
+
+    if (notify) {
+        _notify_commit(writer->obj, writer->changed_prop);
+        _index_update(writer->obj);
+    } else {
+        _invalidate_resolved(writer->obj);
+    }
 
     end:
-    _destroy_object(orig_obj);
+    _epoch_exit();
+
+    if (!ok) {
+        _writer_free_values(writer);
+    }
+
+    _free_writer(writer);
     return ok;
 }
 
+static bool write_try_commit(ct_cdb_obj_o *_writer) {
+    return _write_try_commit(_get_writer_from_obj_o(_writer), true);
+}
+
 
 static void set_float(ct_cdb_obj_o *_writer,
                       uint64_t property,
                       float value) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_FLOAT, &value,
-                                   sizeof(float),
-                                   _G.allocator);
-    }
-
-    ct_array_push(writer->changed_prop, property, _G.allocator);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_FLOAT, sizeof(float));
     value_ptr->f = value;
 }
 
 static void set_bool(ct_cdb_obj_o *_writer,
                      uint64_t property,
                      bool value) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_BOOL, &value,
-                                   sizeof(bool),
-                                   _G.allocator);
-    }
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    ct_array_push(writer->changed_prop, property, _G.allocator);
-
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_BOOL, sizeof(bool));
     value_ptr->b = value;
 }
 
@@ -821,19 +3750,10 @@ static void set_vec3(ct_cdb_obj_o *_writer,
                      const float *value) {
     const size_t size = sizeof(float) * 3;
 
-    struct object_t *writer = _get_object_from_obj_o(_writer);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_VEC3, value,
-                                   size, _G.allocator);
-    }
-
-    ct_array_push(writer->changed_prop, property, _G.allocator);
-
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_VEC3, size);
     memcpy(value_ptr->vec3, value, size);
 }
 
@@ -842,19 +3762,10 @@ static void set_vec4(ct_cdb_obj_o *_writer,
                      const float *value) {
     const size_t size = sizeof(float) * 4;
 
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_VEC4, value,
-                                   size, _G.allocator);
-    }
-
-    ct_array_push(writer->changed_prop, property, _G.allocator);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_VEC4, size);
     memcpy(value_ptr->vec4, value, size);
 }
 
@@ -862,131 +3773,69 @@ static void set_mat4(ct_cdb_obj_o *_writer,
                      uint64_t property,
                      const float *value) {
     const size_t size = sizeof(float) * 16;
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_MAT4, value,
-                                   size, _G.allocator);
-    }
 
-    ct_array_push(writer->changed_prop, property, _G.allocator);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_MAT4, size);
     memcpy(value_ptr->mat4, value, size);
 }
 
 static void set_string(ct_cdb_obj_o *_writer,
                        uint64_t property,
                        const char *value) {
-    struct ct_alloc *a = _G.allocator;
-
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_STR,
-                                   &value, sizeof(char *),
-                                   _G.allocator);
-    } else {
-        union type_u *value_ptr = (union type_u *) (writer->values +
-                                                    writer->offset[idx]);
-
-        CT_FREE(a, value_ptr->str);
-    }
-
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    char *value_clone = ct_memory_a0->str_dup(value, a);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_STR, sizeof(char *));
 
-    ct_array_push(writer->changed_prop, property, _G.allocator);
-
-    value_ptr->str = value_clone;
+    value_ptr->str = _str_intern(value);
 }
 
 static void set_uint64(ct_cdb_obj_o *_writer,
                        uint64_t property,
                        uint64_t value) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property, CDB_TYPE_UINT64,
-                                   &value, sizeof(uint64_t), _G.allocator);
-    }
-    ct_array_push(writer->changed_prop, property, _G.allocator);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_UINT64, sizeof(uint64_t));
     value_ptr->uint64 = value;
 }
 
 static void set_ptr(ct_cdb_obj_o *_writer,
                     uint64_t property,
                     const void *value) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property, CDB_TYPE_PTR, &value,
-                                   sizeof(void *),
-                                   _G.allocator);
-    }
-    ct_array_push(writer->changed_prop, property, _G.allocator);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    memcpy((writer->values + writer->offset[idx]), &value, sizeof(void *));
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_PTR, sizeof(void *));
+    memcpy(value_ptr, &value, sizeof(void *));
 }
 
 static void set_ref(ct_cdb_obj_o *_writer,
                     uint64_t property,
                     uint64_t ref) {
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_REF, &ref,
-                                   sizeof(uint64_t),
-                                   _G.allocator);
-    }
-
-    ct_array_push(writer->changed_prop, property, _G.allocator);
-
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_REF, sizeof(uint64_t));
     value_ptr->ref = ref;
 }
 
 void set_subobject(ct_cdb_obj_o *_writer,
                    uint64_t property,
                    uint64_t subobject) {
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_SUBOBJECT, &subobject,
-                                   sizeof(uint64_t),
-                                   _G.allocator);
-    }
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
-    ct_array_push(writer->changed_prop, property, _G.allocator);
-
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_SUBOBJECT,
+                                           sizeof(uint64_t));
     value_ptr->subobj = subobject;
 
     if (subobject) {
         ct_cdb_obj_o *w = ct_cdb_a0->write_begin(subobject);
-        struct object_t *subobj = _get_object_from_obj_o(w);
-        subobj->parent = writer->obj;
+        struct writer_t *subobj_writer = _get_writer_from_obj_o(w);
+        subobj_writer->parent = writer->obj;
         ct_cdb_a0->write_commit(w);
     }
 
@@ -996,331 +3845,356 @@ void set_blob(ct_cdb_obj_o *_writer,
               uint64_t property,
               void *blob_data,
               uint64_t blob_size) {
-    struct ct_alloc *a = _G.allocator;
-
-    struct object_t *writer = _get_object_from_obj_o(_writer);
-
-    void *new_blob = CT_ALLOC(a, char, blob_size);
-
-    memcpy(new_blob, blob_data, blob_size);
+    struct writer_t *writer = _get_writer_from_obj_o(_writer);
 
     struct blob_t blob = {
             .size = blob_size,
-            .data = new_blob,
+            .data = _blob_new(blob_data, blob_size),
     };
 
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_BLOB,
+                                           sizeof(struct blob_t));
 
-    uint64_t idx = _find_prop_index(writer, property);
-    if (!idx) {
-        idx = _object_new_property(writer, property,
-                                   CDB_TYPE_BLOB,
-                                   &blob, sizeof(struct blob_t),
-                                   _G.allocator);
-    } else {
-        union type_u *value_ptr = (union type_u *) (writer->values +
-                                                    writer->offset[idx]);
-        CT_FREE(a, value_ptr->blob.data);
-    }
-
-    ct_array_push(writer->changed_prop, property, _G.allocator);
+    value_ptr->blob = blob;
+}
 
+static void _invalidate_resolved(uint64_t _obj) {
+    struct object_t *obj = _get_object_from_objid(_obj);
 
-    union type_u *value_ptr = (union type_u *) (writer->values +
-                                                writer->offset[idx]);
+    _object_invalidate_resolved(obj);
 
-    value_ptr->blob = blob;
+    struct instances_t *instances = _instances(_obj);
+    const uint32_t instances_n = _instances_n(instances);
+    for (uint32_t i = 0; i < instances_n; ++i) {
+        _invalidate_resolved(_instances_get(instances, i));
+    }
 }
 
 void set_prefab(uint64_t _obj,
                 uint64_t _prefab) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    struct object_t *prefab = _get_object_from_objid(_prefab);
 
     obj->prefab = _prefab;
-    ct_array_push(prefab->instances,
-                  _obj,
-                  _G.allocator);
+    _instances_add(_prefab, _obj);
+
+    _invalidate_resolved(_obj);
+    _index_update(_obj);
+
+    _epoch_exit();
 }
 
 static bool prop_exist(uint64_t _object,
                        uint64_t key) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_object);
-    return _find_prop_index(obj, key) > 0;
+    bool exist = _find_prop_index(obj, key) > 0;
+
+    _epoch_exit();
+
+    return exist;
 }
 
 static enum ct_cdb_type prop_type(uint64_t _object,
                                   uint64_t key) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_object);
-    uint64_t idx = _find_prop_index(obj, key);
 
-    if (idx) {
-        return (enum ct_cdb_type) obj->property_type[idx];
-    }
+    enum ct_cdb_type type = CDB_TYPE_NONE;
+    _get_value(obj, key, &type);
 
-    if (obj->prefab) {
-        return prop_type(obj->prefab, key);
-    }
+    _epoch_exit();
 
-    return CDB_TYPE_NONE;
+    return type;
 }
 
 static float read_float(uint64_t _obj,
                         uint64_t property,
                         float defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(float *) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_float(obj->prefab, property, defaultt);
-    }
+    float result = value ? *(float *) value : defaultt;
 
-    return defaultt;
+    _epoch_exit();
+
+    return result;
 }
 
 static bool read_bool(uint64_t _obj,
                       uint64_t property,
                       bool defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(bool *) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_bool(obj->prefab, property, defaultt);
-    }
+    bool result = value ? *(bool *) value : defaultt;
 
-    return defaultt;
+    _epoch_exit();
+
+    return result;
 }
 
 static void read_vec3(uint64_t _obj,
                       uint64_t property,
                       float *value) {
-    struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
+    _epoch_enter();
 
+    struct object_t *obj = _get_object_from_objid(_obj);
 
-    if (idx) {
-        const float *f = (const float *) (obj->values + obj->offset[idx]);
-        memcpy(value, f, sizeof(float) * 3);
+    enum ct_cdb_type type;
+    const uint8_t *v = _get_value(obj, property, &type);
 
-        return;
+    if (v) {
+        memcpy(value, v, sizeof(float) * 3);
     }
 
-    if (obj->prefab) {
-        read_vec3(obj->prefab, property, value);
-    }
+    _epoch_exit();
 }
 
 static void read_vec4(uint64_t _obj,
                       uint64_t property,
                       float *value) {
-    struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
+    _epoch_enter();
 
+    struct object_t *obj = _get_object_from_objid(_obj);
 
-    if (idx) {
-        const float *f = (const float *) (obj->values + obj->offset[idx]);
-        memcpy(value, f, sizeof(float) * 4);
+    enum ct_cdb_type type;
+    const uint8_t *v = _get_value(obj, property, &type);
 
-        return;
+    if (v) {
+        memcpy(value, v, sizeof(float) * 4);
     }
 
-    if (obj->prefab) {
-        read_vec4(obj->prefab, property, value);
-    }
+    _epoch_exit();
 }
 
 static void read_mat4(uint64_t _obj,
                       uint64_t property,
                       float *value) {
-    struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
+    _epoch_enter();
 
+    struct object_t *obj = _get_object_from_objid(_obj);
 
-    if (idx) {
-        const float *f = (const float *) (obj->values + obj->offset[idx]);
-        memcpy(value, f, sizeof(float) * 16);
-
-        return;
-    }
+    enum ct_cdb_type type;
+    const uint8_t *v = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        read_mat4(obj->prefab, property, value);
+    if (v) {
+        memcpy(value, v, sizeof(float) * 16);
     }
 
+    _epoch_exit();
 }
 
 static const char *read_string(uint64_t _obj,
                                uint64_t property,
                                const char *defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(const char **) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_string(obj->prefab, property, defaultt);
-    }
+    const char *result = value ? *(const char **) value : defaultt;
+
+    _epoch_exit();
 
-    return defaultt;
+    return result;
 }
 
 
 static uint64_t read_uint64(uint64_t _obj,
                             uint64_t property,
                             uint64_t defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(uint64_t *) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_uint64(obj->prefab, property, defaultt);
-    }
+    uint64_t result = value ? *(uint64_t *) value : defaultt;
+
+    _epoch_exit();
 
-    return defaultt;
+    return result;
 }
 
 static void *read_ptr(uint64_t _obj,
                       uint64_t property,
                       void *defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(void **) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_ptr(obj->prefab, property, defaultt);
-    }
+    void *result = value ? *(void **) value : defaultt;
+
+    _epoch_exit();
 
-    return defaultt;
+    return result;
 }
 
 static uint64_t read_ref(uint64_t _obj,
                          uint64_t property,
                          uint64_t defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(uint64_t *) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_ref(obj->prefab, property, defaultt);
+    uint64_t result = value ? *(uint64_t *) value : defaultt;
+
+    _epoch_exit();
+
+    return result;
+}
+
+// Instance own subobject that is instance of prefab subobject, so writes
+// to it don't change prefab.
+// Commit is based on version where property was seen inherited, if other
+// thread instanced it meanwhile commit fail and its subobject is used.
+static uint64_t _instance_subobject(uint64_t _obj,
+                                    struct object_t *version,
+                                    uint64_t property,
+                                    uint64_t prefab_subobj) {
+    uint64_t subobj = create_from(version->db, prefab_subobj);
+    _get_object_from_objid(subobj)->parent = _obj;
+
+    struct writer_t *writer = _get_writer_from_obj_o(write_begin(_obj));
+    writer->orig_version = version->idx;
+
+    union type_u *value_ptr = _writer_prop(writer, property,
+                                           CDB_TYPE_SUBOBJECT,
+                                           sizeof(uint64_t));
+    value_ptr->subobj = subobj;
+
+    if (_write_try_commit(writer, false)) {
+        return subobj;
     }
 
-    return defaultt;
+    // Object changed meanwhile, other thread can instance it first.
+    destroy_object(subobj);
+    return read_subobject(_obj, property, 0);
 }
 
 static uint64_t read_subobject(uint64_t _obj,
                                uint64_t property,
                                uint64_t defaultt) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        return *(uint64_t *) (obj->values + obj->offset[idx]);
-    }
+    enum ct_cdb_type type = CDB_TYPE_NONE;
+    const uint8_t *value = _get_value(obj, property, &type);
 
-    if (obj->prefab) {
-        return read_subobject(obj->prefab, property, defaultt);
+    uint64_t result = value ? *(uint64_t *) value : defaultt;
+
+    if (value && result && (type == CDB_TYPE_SUBOBJECT) &&
+        !_find_prop_index(obj, property)) {
+        result = _instance_subobject(_obj, obj, property, result);
     }
 
-    return defaultt;
+    _epoch_exit();
+
+    return result;
 }
 
 void *read_blob(uint64_t _obj,
                 uint64_t property,
                 uint64_t *size,
                 void *defaultt) {
+    _epoch_enter();
 
     struct object_t *obj = _get_object_from_objid(_obj);
-    uint64_t idx = _find_prop_index(obj, property);
 
-    if (idx) {
-        void *data = (obj->values + obj->offset[idx]);
+    enum ct_cdb_type type;
+    const uint8_t *value = _get_value(obj, property, &type);
+
+    void *result = defaultt;
 
-        struct blob_t *blob = data;
+    if (value) {
+        const struct blob_t *blob = (const struct blob_t *) value;
 
         if (size) {
             *size = blob->size;
         }
 
-        return blob->data;
+        result = blob->data;
     }
 
-    if (obj->prefab) {
-        return read_blob(obj->prefab, property, size, defaultt);
-    }
+    _epoch_exit();
 
-    return defaultt;
+    return result;
 }
 
-static uint64_t prop_count(uint64_t _obj);
-
 static void prop_keys(uint64_t _obj,
                       uint64_t *keys) {
-    struct object_t *obj = _get_object_from_objid(_obj);
+    _epoch_enter();
 
-    if (obj->prefab) {
-        memcpy(keys, obj->keys + 1,
-               sizeof(uint64_t) * (obj->properties_count - 1));
+    struct object_t *obj = _get_object_from_objid(_obj);
 
-        keys += (obj->properties_count - 1);
+    const uint64_t n = obj->layout->properties_count - 1;
+    memcpy(keys, obj->layout->keys + 1, sizeof(uint64_t) * n);
 
-        uint32_t prefab_prop_count = prop_count(obj->prefab);
+    if (obj->prefab) {
+        keys += n;
 
-        uint64_t prefab_keys[prefab_prop_count];
-        prop_keys(obj->prefab, prefab_keys);
+        uint8_t *values;
+        struct object_t *prefab = _get_object_from_objid(obj->prefab);
+        struct object_layout_t *layout = _prefab_view(prefab, &values);
 
-        for (int i = 0; i < prefab_prop_count; ++i) {
-            if (ct_hash_contain(&obj->prop_map, prefab_keys[i])) {
+        for (uint64_t i = 1; i < layout->properties_count; ++i) {
+            if (_find_prop_index(obj, layout->keys[i])) {
                 continue;
             }
 
-            keys[i] = prefab_keys[i];
+            *keys++ = layout->keys[i];
         }
-
-        return;
     }
 
-    memcpy(keys, obj->keys + 1, sizeof(uint64_t) * (obj->properties_count - 1));
+    _epoch_exit();
 }
 
 static uint64_t prop_count(uint64_t _obj) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
 
-    uint64_t count = obj->properties_count - 1;
+    uint64_t count = obj->layout->properties_count - 1;
 
     if (obj->prefab) {
-        uint32_t prefab_prop_count = prop_count(obj->prefab);
+        uint8_t *values;
+        struct object_t *prefab = _get_object_from_objid(obj->prefab);
+        struct object_layout_t *layout = _prefab_view(prefab, &values);
 
-        uint64_t keys[prefab_prop_count];
-        prop_keys(obj->prefab, keys);
-
-        for (int i = 0; i < prefab_prop_count; ++i) {
-            if (ct_hash_contain(&obj->prop_map, keys[i])) {
+        for (uint64_t i = 1; i < layout->properties_count; ++i) {
+            if (_find_prop_index(obj, layout->keys[i])) {
                 continue;
             }
 
             count += 1;
         }
-
     }
 
+    _epoch_exit();
+
     return count;
 }
 
@@ -1337,30 +4211,60 @@ void register_notify(uint64_t _obj,
     ct_array_push(obj->notify, pair, _G.allocator);
 }
 
+void register_notify_batch(uint64_t _obj,
+                           ct_cdb_notify_batch notify,
+                           void *data) {
+    struct object_t *obj = _get_object_from_objid(_obj);
+
+    struct notify_pair pair = {
+            .notify_batch = notify,
+            .data = data
+    };
+
+    ct_array_push(obj->notify, pair, _G.allocator);
+}
+
 
 static struct ct_cdb_t global_db() {
     return _G.global_db;
 }
 
 static uint64_t type(uint64_t _obj) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(_obj);
+    uint64_t type = obj->type;
+
+    _epoch_exit();
 
-    return obj->type;
+    return type;
 }
 
 void set_type(uint64_t _obj,
               uint64_t type) {
     struct object_t *obj = _get_object_from_objid(_obj);
+
+    _index_remove(&_G.dbs[obj->db.idx], obj->id);
     obj->type = type;
+    _index_object(obj);
 }
 
 uint64_t parent(uint64_t object) {
+    _epoch_enter();
+
     struct object_t *obj = _get_object_from_objid(object);
-    return obj->parent;
+    uint64_t parent = obj->parent;
+
+    _epoch_exit();
+
+    return parent;
 }
 
 static struct ct_cdb_a0 cdb_api = {
         .register_notify = register_notify,
+        .register_notify_batch = register_notify_batch,
+        .set_notify_deferred = set_notify_deferred,
+        .flush_notify = flush_notify,
 //        .create_db = create_db,
 
         . db  = global_db,
@@ -1373,9 +4277,22 @@ static struct ct_cdb_a0 cdb_api = {
         .destroy_db = destroy_db,
 
         .gc = gc,
+        .stats = stats,
+
+        .query_type = query_type,
+        .create_index = create_index,
+        .query_value = query_value,
+
+        .set_changelog = set_changelog,
+        .snapshot = snapshot,
+        .changes = changes,
+        .read_at = read_at,
+        .trim_changelog = trim_changelog,
 
         .dump = dump,
         .load = load,
+        .save_image = save_image,
+        .load_image = load_image,
 
         .prop_exist = prop_exist,
         .prop_type = prop_type,
@@ -1383,6 +4300,8 @@ static struct ct_cdb_a0 cdb_api = {
         .prop_count = prop_count,
         .parent = parent,
 
+        .read_begin = _epoch_enter,
+        .read_end = _epoch_exit,
         .read_float = read_float,
         .read_bool = read_bool,
         .read_vec3 = read_vec3,
@@ -1420,6 +4339,11 @@ static void _init(struct ct_api_a0 *api) {
             .allocator = ct_memory_a0->system,
     };
 
+    _G.root_shape = _new_layout(_G.allocator);
+    _G.root_shape->shape = true;
+
+    _G.heavy_barrier = _heavy_barrier_init();
+
     _G.global_db = create_db();
 
     api->register_api("ct_cdb_a0", &cdb_api);
@@ -161,7 +161,7 @@ static void foreach_config_clb(struct ct_yng_node key,
                         break;
                 }
 
-                ct_cdb_a0->write_begin(_G.config_object);
+                ct_cdb_a0->write_commit(writer);
             }
         }
     }
@@ -21,11 +21,11 @@ bool ct_corelib_init() {
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, hashlib);
 
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, os);
-    CETECH_LOAD_STATIC_MODULE(ct_api_a0, task);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, cdb);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, ebus);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, yamlng);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, config);
+    CETECH_LOAD_STATIC_MODULE(ct_api_a0, task);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, filesystem);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, module);
     CETECH_LOAD_STATIC_MODULE(ct_api_a0, ydb);
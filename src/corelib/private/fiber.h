@@ -0,0 +1,65 @@
+#ifndef CETECH_FIBER_H
+#define CETECH_FIBER_H
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <ucontext.h>
+#include <corelib/macros.h>
+#include "corelib/allocator.h"
+
+//==============================================================================
+// Implementation
+//==============================================================================
+
+// ucontext is deprecated on darwin but still the only portable option.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+// Fiber with own stack. Fiber without stack is context of thread that
+// switch to other fiber.
+struct fiber {
+    ucontext_t ctx;
+    void *stack;
+    uint32_t stack_size;
+    struct ct_alloc *allocator;
+};
+
+void fiber_create(struct fiber *f,
+                  uint32_t stack_size,
+                  void (*fce)(),
+                  struct ct_alloc *allocator) {
+    *f = (struct fiber) {
+            .stack_size = stack_size,
+            .allocator = allocator,
+    };
+
+    f->stack = CT_ALLOC(allocator, char, stack_size);
+
+    getcontext(&f->ctx);
+    f->ctx.uc_stack.ss_sp = f->stack;
+    f->ctx.uc_stack.ss_size = stack_size;
+    f->ctx.uc_link = NULL;
+
+    // fce must never return
+    makecontext(&f->ctx, fce, 0);
+}
+
+void fiber_destroy(struct fiber *f) {
+    if (f->stack) {
+        CT_FREE(f->allocator, f->stack);
+    }
+
+    *f = (struct fiber) {};
+}
+
+// Save current context to from and continue in to.
+void fiber_switch(struct fiber *from,
+                  struct fiber *to) {
+    swapcontext(&from->ctx, &to->ctx);
+}
+
+#pragma GCC diagnostic pop
+
+#endif //CETECH_FIBER_H
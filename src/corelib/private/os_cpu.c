@@ -1,13 +1,100 @@
 #include <include/SDL2/SDL_cpuinfo.h>
+#include <corelib/platform.h>
 #include <corelib/os.h>
 #include <corelib/module.h>
 #include <corelib/api_system.h>
 #include "corelib/macros.h"
 
+#if CT_PLATFORM_LINUX
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NUMA_NODE_PATH "/sys/devices/system/node/node%u"
+#endif
+
 int cpu_count() {
     return SDL_GetCPUCount();
 }
 
+uint32_t cpu_numa_node_count() {
+#if CT_PLATFORM_LINUX
+    char path[128];
+    uint32_t n = 0;
+
+    while (true) {
+        snprintf(path, CT_ARRAY_LEN(path), NUMA_NODE_PATH, n);
+
+        if (access(path, F_OK)) {
+            break;
+        }
+
+        ++n;
+    }
+
+    return n ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+static uint32_t _all_cpus(uint32_t *cpus,
+                          uint32_t max_cpus) {
+    uint32_t n = (uint32_t) cpu_count();
+    n = n < max_cpus ? n : max_cpus;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        cpus[i] = i;
+    }
+
+    return n;
+}
+
+uint32_t cpu_numa_node_cpus(uint32_t node,
+                            uint32_t *cpus,
+                            uint32_t max_cpus) {
+#if CT_PLATFORM_LINUX
+    char path[128];
+    snprintf(path, CT_ARRAY_LEN(path), NUMA_NODE_PATH "/cpulist", node);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return node ? 0 : _all_cpus(cpus, max_cpus);
+    }
+
+    char list[1024] = {};
+    char *c = fgets(list, CT_ARRAY_LEN(list), f);
+    fclose(f);
+
+    // Format: 0-3,8-11,16
+    uint32_t n = 0;
+    while (c && *c && (*c != '\n') && (n < max_cpus)) {
+        uint32_t first = (uint32_t) strtoul(c, &c, 10);
+        uint32_t last = first;
+
+        if (*c == '-') {
+            last = (uint32_t) strtoul(c + 1, &c, 10);
+        }
+
+        for (uint32_t i = first; (i <= last) && (n < max_cpus); ++i) {
+            cpus[n++] = i;
+        }
+
+        if (*c != ',') {
+            break;
+        }
+
+        ++c;
+    }
+
+    return n;
+#else
+    return node ? 0 : _all_cpus(cpus, max_cpus);
+#endif
+}
+
 struct ct_os_cpu_a0 cpu_api = {
-        .count = cpu_count
+        .count = cpu_count,
+        .numa_node_count = cpu_numa_node_count,
+        .numa_node_cpus = cpu_numa_node_cpus,
 };
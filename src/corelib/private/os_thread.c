@@ -1,8 +1,13 @@
+#if defined(__linux__)
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
 #include "include/SDL2/SDL.h"
 #include <corelib/platform.h>
 
 #if CT_PLATFORM_LINUX
 #include <sched.h>
+#include <pthread.h>
 #endif
 
 #if CT_PLATFORM_OSX
@@ -72,6 +77,39 @@ void thread_spin_unlock(struct ct_spinlock *lock) {
     SDL_AtomicUnlock((SDL_SpinLock *) lock);
 }
 
+ct_sem_t *thread_sem_create(uint32_t value) {
+    return (ct_sem_t *) SDL_CreateSemaphore(value);
+}
+
+void thread_sem_destroy(ct_sem_t *sem) {
+    SDL_DestroySemaphore((SDL_sem *) sem);
+}
+
+void thread_sem_post(ct_sem_t *sem) {
+    SDL_SemPost((SDL_sem *) sem);
+}
+
+void thread_sem_wait(ct_sem_t *sem) {
+    SDL_SemWait((SDL_sem *) sem);
+}
+
+bool thread_set_affinity(const uint32_t *cpus,
+                         uint32_t cpu_count) {
+#if CT_PLATFORM_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        CPU_SET(cpus[i], &set);
+    }
+
+    return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    CT_UNUSED(cpus, cpu_count);
+    return false;
+#endif
+}
+
 struct ct_os_thread_a0 thread_api = {
         .create = thread_create,
         .kill = thread_kill,
@@ -80,7 +118,12 @@ struct ct_os_thread_a0 thread_api = {
         .actual_id = thread_actual_id,
         .yield = thread_yield,
         .spin_lock = thread_spin_lock,
-        .spin_unlock = thread_spin_unlock
+        .spin_unlock = thread_spin_unlock,
+        .sem_create = thread_sem_create,
+        .sem_destroy = thread_sem_destroy,
+        .sem_post = thread_sem_post,
+        .sem_wait = thread_sem_wait,
+        .set_affinity = thread_set_affinity,
 };
 
 struct ct_os_thread_a0 *ct_thread_a0 = &thread_api;
@@ -0,0 +1,199 @@
+#ifndef CETECH_POOL_PAGED_H
+#define CETECH_POOL_PAGED_H
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdatomic.h>
+#include <corelib/macros.h>
+#include "corelib/allocator.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+#define POOL_PAGE_SHIFT 12
+#define POOL_PAGE_SIZE (1u << POOL_PAGE_SHIFT)
+#define POOL_PAGE_MASK (POOL_PAGE_SIZE - 1)
+#define POOL_MAX_PAGES 1024
+
+//==============================================================================
+// Implementation
+//==============================================================================
+
+// Growable pool of fixed size items addressed by index.
+// Pages are allocated on demand and never move or free until destroy, so
+// item pointers are stable. Index 0 is reserved as null.
+// Free items are recycled with lock-free stack, head is tag << 32 | idx.
+struct pool_paged {
+    _Atomic(uint8_t *) pages[POOL_MAX_PAGES];
+    atomic_uint next_idx;
+    atomic_ullong free_head;
+    uint32_t item_size;
+    struct ct_alloc *allocator;
+};
+
+// Page layout: free list links followed by items.
+#define _POOL_LINKS_SIZE (sizeof(atomic_uint) * POOL_PAGE_SIZE)
+
+void pool_paged_init(struct pool_paged *p,
+                     uint32_t item_size,
+                     struct ct_alloc *allocator) {
+    *p = (struct pool_paged) {
+            .item_size = item_size,
+            .allocator = allocator,
+    };
+
+    for (uint32_t i = 0; i < POOL_MAX_PAGES; ++i) {
+        atomic_init(&p->pages[i], NULL);
+    }
+
+    atomic_init(&p->next_idx, 1);
+    atomic_init(&p->free_head, 0);
+}
+
+void pool_paged_destroy(struct pool_paged *p) {
+    for (uint32_t i = 0; i < POOL_MAX_PAGES; ++i) {
+        uint8_t *page = atomic_load(&p->pages[i]);
+
+        if (page) {
+            CT_FREE(p->allocator, page);
+        }
+    }
+}
+
+static inline atomic_uint *_pool_paged_link(struct pool_paged *p,
+                                            uint32_t idx) {
+    uint8_t *page = atomic_load_explicit(&p->pages[idx >> POOL_PAGE_SHIFT],
+                                         memory_order_acquire);
+
+    return ((atomic_uint *) page) + (idx & POOL_PAGE_MASK);
+}
+
+static inline void *pool_paged_get(struct pool_paged *p,
+                                   uint32_t idx) {
+    uint8_t *page = atomic_load_explicit(&p->pages[idx >> POOL_PAGE_SHIFT],
+                                         memory_order_acquire);
+
+    return page + _POOL_LINKS_SIZE + ((idx & POOL_PAGE_MASK) * p->item_size);
+}
+
+static void _pool_paged_alloc_page(struct pool_paged *p,
+                                   uint32_t page_idx) {
+    if (atomic_load(&p->pages[page_idx])) {
+        return;
+    }
+
+    const uint32_t size = _POOL_LINKS_SIZE + (POOL_PAGE_SIZE * p->item_size);
+    uint8_t *page = CT_ALLOC(p->allocator, uint8_t, size);
+
+    uint8_t *expected = NULL;
+    if (!atomic_compare_exchange_strong(&p->pages[page_idx], &expected,
+                                        page)) {
+        // Other thread was faster.
+        CT_FREE(p->allocator, page);
+    }
+}
+
+// Return new index or 0 if pool is full.
+uint32_t pool_paged_alloc(struct pool_paged *p) {
+    uint64_t head = atomic_load(&p->free_head);
+
+    while ((uint32_t) head) {
+        const uint32_t idx = (uint32_t) head;
+
+        // Link can be stale if other thread pop idx first, tag fail CAS.
+        const uint64_t next = (((head >> 32) + 1) << 32) |
+                              atomic_load(_pool_paged_link(p, idx));
+
+        if (atomic_compare_exchange_weak(&p->free_head, &head, next)) {
+            return idx;
+        }
+    }
+
+    const uint32_t idx = atomic_fetch_add(&p->next_idx, 1);
+
+    if (idx >= (POOL_MAX_PAGES * POOL_PAGE_SIZE)) {
+        atomic_fetch_sub(&p->next_idx, 1);
+        return 0;
+    }
+
+    _pool_paged_alloc_page(p, idx >> POOL_PAGE_SHIFT);
+
+    return idx;
+}
+
+// Allocate up to n indices. First n items are popped from free list with
+// one CAS, rest is taken from fresh range with one add. Return count (less
+// if pool is full).
+uint32_t pool_paged_alloc_n(struct pool_paged *p,
+                            uint32_t *idx,
+                            uint32_t n) {
+    uint32_t count = 0;
+
+    uint64_t head = atomic_load(&p->free_head);
+    while ((uint32_t) head) {
+        // Links can be stale if other thread pop first, tag fail CAS.
+        uint32_t it = (uint32_t) head;
+        while (it && (count < n)) {
+            idx[count++] = it;
+            it = atomic_load(_pool_paged_link(p, it));
+        }
+
+        const uint64_t next = (((head >> 32) + 1) << 32) | it;
+
+        if (atomic_compare_exchange_weak(&p->free_head, &head, next)) {
+            break;
+        }
+
+        count = 0;
+    }
+
+    if (count == n) {
+        return count;
+    }
+
+    const uint32_t max_idx = POOL_MAX_PAGES * POOL_PAGE_SIZE;
+    const uint32_t want = n - count;
+    const uint32_t first = atomic_fetch_add(&p->next_idx, want);
+
+    if (first >= max_idx) {
+        atomic_fetch_sub(&p->next_idx, want);
+        return count;
+    }
+
+    const uint32_t got = (max_idx - first) < want ? (max_idx - first) : want;
+
+    // Give back range past the end so retries on full pool don't overflow.
+    if (got < want) {
+        atomic_fetch_sub(&p->next_idx, want - got);
+    }
+
+    for (uint32_t i = 0; i < got; ++i) {
+        const uint32_t new_idx = first + i;
+
+        if (!i || !(new_idx & POOL_PAGE_MASK)) {
+            _pool_paged_alloc_page(p, new_idx >> POOL_PAGE_SHIFT);
+        }
+
+        idx[count++] = new_idx;
+    }
+
+    return count;
+}
+
+void pool_paged_free(struct pool_paged *p,
+                     uint32_t idx) {
+    atomic_uint *link = _pool_paged_link(p, idx);
+
+    uint64_t head = atomic_load(&p->free_head);
+    uint64_t new_head;
+
+    do {
+        atomic_store(link, (uint32_t) head);
+        new_head = (((head >> 32) + 1) << 32) | idx;
+    } while (!atomic_compare_exchange_weak(&p->free_head, &head, new_head));
+}
+
+#endif //CETECH_POOL_PAGED_H
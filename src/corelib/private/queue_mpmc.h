@@ -65,10 +65,10 @@ void queue_task_destroy(struct queue_mpmc *q) {
 }
 
 uint32_t queue_task_size(struct queue_mpmc *q) {
-    uint32_t e = atomic_load(&q->_enqueuePos) & q->_capacityMask;
-    uint32_t d = atomic_load(&q->_dequeuePos) & q->_capacityMask;
+    uint32_t e = atomic_load(&q->_enqueuePos);
+    uint32_t d = atomic_load(&q->_dequeuePos);
 
-    return e > d ? e - d : d - e;
+    return e - d;
 }
 
 int queue_task_push(struct queue_mpmc *q,
@@ -134,4 +134,112 @@ int queue_task_pop(struct queue_mpmc *q,
     return 1;
 }
 
+// Push up to n values, contiguous range of free slots is reserved with
+// one CAS. Return pushed count, 0 if queue is full.
+uint32_t queue_task_push_n(struct queue_mpmc *q,
+                           const uint32_t *values,
+                           uint32_t n) {
+    int pos = atomic_load_explicit(&q->_enqueuePos, memory_order_relaxed);
+    uint32_t count;
+
+    for (;;) {
+        count = 0;
+        while (count < n) {
+            const int p = pos + count;
+            int seq = atomic_load_explicit(q->_sequences + (p & q->_capacityMask),
+                                           memory_order_acquire);
+
+            if (seq != p) {
+                break;
+            }
+
+            ++count;
+        }
+
+        if (!count) {
+            int seq = atomic_load_explicit(
+                    q->_sequences + (pos & q->_capacityMask),
+                    memory_order_acquire);
+
+            if (((intptr_t) seq - (intptr_t) pos) < 0) {
+                return 0;
+            }
+
+            pos = atomic_load_explicit(&q->_enqueuePos, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&q->_enqueuePos, &pos,
+                                                  pos + count,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const int p = pos + i;
+
+        q->_data[p & q->_capacityMask] = values[i];
+        atomic_store_explicit(&q->_sequences[p & q->_capacityMask], p + 1,
+                              memory_order_release);
+    }
+
+    return count;
+}
+
+// Pop up to n values, contiguous range of published slots is reserved with
+// one CAS. Return poped count, 0 if queue is empty.
+uint32_t queue_task_pop_n(struct queue_mpmc *q,
+                          uint32_t *values,
+                          uint32_t n) {
+    int pos = atomic_load_explicit(&q->_dequeuePos, memory_order_relaxed);
+    uint32_t count;
+
+    for (;;) {
+        count = 0;
+        while (count < n) {
+            const int p = pos + count;
+            int seq = atomic_load_explicit(q->_sequences + (p & q->_capacityMask),
+                                           memory_order_acquire);
+
+            if (seq != (p + 1)) {
+                break;
+            }
+
+            ++count;
+        }
+
+        if (!count) {
+            int seq = atomic_load_explicit(
+                    q->_sequences + (pos & q->_capacityMask),
+                    memory_order_acquire);
+
+            if (((intptr_t) seq - (intptr_t) (pos + 1)) < 0) {
+                return 0;
+            }
+
+            pos = atomic_load_explicit(&q->_dequeuePos, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&q->_dequeuePos, &pos,
+                                                  pos + count,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const int p = pos + i;
+
+        values[i] = q->_data[p & q->_capacityMask];
+        atomic_store_explicit(&q->_sequences[p & q->_capacityMask],
+                              p + q->_capacityMask + 1, memory_order_release);
+    }
+
+    return count;
+}
+
 #endif //CETECH_QUEUE_MPMC_H
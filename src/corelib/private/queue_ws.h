@@ -0,0 +1,156 @@
+#ifndef CETECH_QUEUE_WS_H
+#define CETECH_QUEUE_WS_H
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdatomic.h>
+#include <corelib/os.h>
+#include <corelib/macros.h>
+#include "corelib/allocator.h"
+
+//==============================================================================
+// Implementation
+//==============================================================================
+
+// Chase-Lev work-stealing deque.
+// Only owner thread can push and pop (bottom), any thread can steal (top).
+// Indices only grow and wrap around, they are compared as (int32_t) (b - t).
+struct queue_ws {
+    uint32_t *_data;
+    uint32_t _capacityMask;
+    struct ct_alloc *allocator;
+    char _pad1[64];
+    atomic_uint _top;
+    char _pad2[64];
+    atomic_uint _bottom;
+    char _pad3[64];
+};
+
+void queue_ws_init(struct queue_ws *q,
+                   uint32_t capacity,
+                   struct ct_alloc *allocator) {
+    *q = (struct queue_ws) {};
+
+    q->_capacityMask = capacity - 1;
+    q->allocator = allocator;
+
+    // capacity must be power of two
+    CETECH_ASSERT("QUEUEWS", 0 == (capacity & q->_capacityMask));
+
+    q->_data = CT_ALLOC(allocator, uint32_t, sizeof(uint32_t) * capacity);
+
+    atomic_init(&q->_top, 0);
+    atomic_init(&q->_bottom, 0);
+}
+
+void queue_ws_destroy(struct queue_ws *q) {
+    CT_FREE(q->allocator, q->_data);
+}
+
+uint32_t queue_ws_size(struct queue_ws *q) {
+    uint32_t b = atomic_load_explicit(&q->_bottom, memory_order_relaxed);
+    uint32_t t = atomic_load_explicit(&q->_top, memory_order_relaxed);
+
+    const int32_t size = (int32_t) (b - t);
+    return size > 0 ? (uint32_t) size : 0;
+}
+
+// Owner only
+int queue_ws_push(struct queue_ws *q,
+                  uint32_t value) {
+    uint32_t b = atomic_load_explicit(&q->_bottom, memory_order_relaxed);
+    uint32_t t = atomic_load_explicit(&q->_top, memory_order_acquire);
+
+    if ((b - t) > q->_capacityMask) {
+        return 0;
+    }
+
+    q->_data[b & q->_capacityMask] = value;
+
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->_bottom, b + 1, memory_order_relaxed);
+
+    return 1;
+}
+
+// Owner only, return pushed count.
+uint32_t queue_ws_push_n(struct queue_ws *q,
+                         const uint32_t *values,
+                         uint32_t n) {
+    uint32_t b = atomic_load_explicit(&q->_bottom, memory_order_relaxed);
+    uint32_t t = atomic_load_explicit(&q->_top, memory_order_acquire);
+
+    const uint32_t size = b - t;
+    const uint32_t free = (q->_capacityMask + 1) - size;
+    const uint32_t count = n < free ? n : free;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        q->_data[(b + i) & q->_capacityMask] = values[i];
+    }
+
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->_bottom, b + count, memory_order_relaxed);
+
+    return count;
+}
+
+// Owner only
+int queue_ws_pop(struct queue_ws *q,
+                 uint32_t *value) {
+    uint32_t b = atomic_load_explicit(&q->_bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&q->_bottom, b, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint32_t t = atomic_load_explicit(&q->_top, memory_order_relaxed);
+
+    if ((int32_t) (b - t) < 0) {
+        // empty
+        atomic_store_explicit(&q->_bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    *value = q->_data[b & q->_capacityMask];
+
+    if (t != b) {
+        return 1;
+    }
+
+    // last element, race with thieves
+    int ok = atomic_compare_exchange_strong_explicit(&q->_top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed);
+
+    atomic_store_explicit(&q->_bottom, b + 1, memory_order_relaxed);
+
+    return ok;
+}
+
+// Any thread
+int queue_ws_steal(struct queue_ws *q,
+                   uint32_t *value) {
+    uint32_t t = atomic_load_explicit(&q->_top, memory_order_acquire);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint32_t b = atomic_load_explicit(&q->_bottom, memory_order_acquire);
+
+    if ((int32_t) (b - t) <= 0) {
+        return 0;
+    }
+
+    uint32_t v = q->_data[t & q->_capacityMask];
+
+    if (!atomic_compare_exchange_strong_explicit(&q->_top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return 0;
+    }
+
+    *value = v;
+    return 1;
+}
+
+#endif //CETECH_QUEUE_WS_H
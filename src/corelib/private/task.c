@@ -2,6 +2,9 @@
 // Includes
 //==============================================================================
 
+#if defined(__APPLE__)
+#define _XOPEN_SOURCE 600 // ucontext
+#endif
 
 #include <corelib/api_system.h>
 #include <corelib/memory.h>
@@ -9,8 +12,16 @@
 #include <corelib/log.h>
 #include <corelib/task.h>
 #include <corelib/module.h>
+#include <corelib/cdb.h>
+#include <corelib/config.h>
+#include <corelib/hashlib.h>
+#include <corelib/array.inl>
+#include <corelib/buffer.inl>
 
 #include "queue_mpmc.h"
+#include "queue_ws.h"
+#include "fiber.h"
+#include "pool_paged.h"
 
 
 //==============================================================================
@@ -19,8 +30,26 @@
 
 #define make_task(i) (task_id_t){.id = i}
 
-#define MAX_TASK 4096
-#define MAX_COUNTERS 4096
+#define QUEUE_SIZE 4096
+#define ADD_BATCH 256
+#define POP_BATCH 8
+#define COUNTER_FIRED UINT32_MAX
+#define WAKE_NONE (-1)
+#define WAKE_ANY (-2)
+#define DEFAULT_SPIN_BUDGET 64
+#define DEFAULT_RESERVED_WORKERS 0
+#define DEFAULT_FIBERS 0
+#define MAX_FIBERS 128
+#define FIBER_STACK_SIZE (256 * 1024)
+#define DEFAULT_TRACE 0
+#define DEFAULT_WORKER_COUNT 0
+#define DEFAULT_MAIN_THREADS (1 + 1/* Renderer */)
+#define DEFAULT_AFFINITY 0
+#define DEFAULT_NUMA 0
+#define MAX_PIN_CPUS 1024
+#define PARALLEL_FOR_PROBE_DIV 64
+#define PARALLEL_FOR_SERIAL_NS 20000
+#define TRACE_BUFFER_SIZE (1u << 16)
 #define LOG_WHERE "taskmanager"
 #define _G TaskManagerGlobal
 
@@ -35,6 +64,26 @@ struct task_t {
 
     const char *name;
     uint32_t counter;
+
+    // next task in counter continuation list
+    uint32_t next;
+
+    uint8_t priority;
+};
+
+struct counter_t {
+    atomic_int value;
+
+    // Continuation list head (task id), COUNTER_FIRED after reach zero.
+    atomic_uint continuation;
+
+    // Nonzero value fiber wait for, WAKE_ANY if more values.
+    atomic_int wake_value;
+
+    uint32_t idx;
+
+    // Internal join counter nobody wait for, released when it fire.
+    bool release_on_fire;
 };
 
 typedef struct {
@@ -43,74 +92,545 @@ typedef struct {
 
 static const task_id_t task_null = (task_id_t) {.id = 0};
 
+// Lanes in drain order, background must be last.
+static const uint8_t _lane_order[TASK_PRIORITY_COUNT] = {
+        TASK_PRIORITY_FRAME,
+        TASK_PRIORITY_NORMAL,
+        TASK_PRIORITY_BACKGROUND,
+};
+
+enum {
+    SLEEP_GROUP_ANY = 0,
+    SLEEP_GROUP_RESERVED,
+    SLEEP_GROUP_COUNT,
+};
+
+struct sleep_group {
+    ct_sem_t *sem;
+    atomic_int sleeping;
+};
+
+struct task_fiber {
+    struct fiber fiber;
+    task_id_t task;
+
+    struct counter_t *wait_counter;
+    int32_t wait_value;
+};
+
+enum trace_event_type {
+    TRACE_TASK = 0,
+    TRACE_WAIT,
+    TRACE_IDLE,
+    TRACE_STEAL,
+};
+
+struct trace_event {
+    uint64_t begin;
+    uint64_t end;
+    const char *name;
+    uint32_t type;
+};
+
+// Ring buffer, written only by owner worker.
+struct trace_buffer {
+    struct trace_event *events;
+    atomic_uint head;
+};
+
+// Worker 0 is main thread.
+struct worker_t {
+    ct_thread_t *thread;
+
+    // Work-stealing queue per lane.
+    struct queue_ws queue[TASK_PRIORITY_COUNT];
+
+    struct trace_buffer trace;
+};
+
+// Fibers are owned by worker and never migrate to other thread.
+struct worker_fibers {
+    struct fiber scheduler;
+
+    struct task_fiber fiber[MAX_FIBERS];
+    uint32_t fiber_n;
+
+    uint32_t *free_fiber;
+    uint32_t *wait_fiber;
+};
+
+struct parallel_for;
+
+struct parallel_for_range {
+    struct parallel_for *pf;
+    uint32_t begin;
+    uint32_t end;
+};
+
+struct parallel_for {
+    ct_task_range_work_t work;
+    void *data;
+    uint32_t grain;
+    uint32_t counter;
+
+    atomic_uint range_n;
+    struct parallel_for_range *ranges;
+};
+
 static struct _G {
-    ct_thread_t *workers[TASK_MAX_WORKERS - 1];
 
     // TASK
-    struct task_t task_pool[MAX_TASK];
-    atomic_int task_pool_idx;
-    struct queue_mpmc free_task;
+    struct pool_paged task_pool;
 
     // COUNTERS
-    atomic_int counter_pool_idx;
-    atomic_int counter_pool[MAX_COUNTERS];
-    struct queue_mpmc free_counter;
+    struct pool_paged counter_pool;
 
     uint32_t workers_count;
 
-    struct queue_mpmc job_queue;
-    int is_running;
+    // Tasks added from threads without own queue.
+    struct queue_mpmc job_queue[TASK_PRIORITY_COUNT];
+
+    // Workers, main thread is worker 0.
+    struct worker_t *worker;
+
+    // Idle workers
+    struct sleep_group sleep[SLEEP_GROUP_COUNT];
+    uint32_t spin_budget;
+
+    // Workers 1..reserved_workers never run background tasks.
+    uint32_t reserved_workers;
+
+    // Placement
+    uint32_t main_threads;
+    bool affinity;
+    bool numa;
+
+    // Workers are running
+    bool started;
+
+    // Fiber mode
+    bool use_fibers;
+    struct worker_fibers *fibers;
+    atomic_int fiber_waiting;
+
+    // Trace
+    atomic_int trace;
+
+    // Parallel for range cheaper than this run serial.
+    uint64_t parallel_for_serial_ticks;
+
+    uint64_t config;
+    atomic_int is_running;
     struct ct_alloc *allocator;
 } _G;
 
 // Private
 static __thread uint8_t _worker_id = 0;
+static __thread bool _has_queue = false;
+static __thread uint8_t _task_priority = TASK_PRIORITY_NORMAL;
+static __thread struct task_fiber *_current_fiber = NULL;
 
 //==============================================================================
 //==============================================================================
 
+static void _wake_workers(uint32_t n,
+                          uint8_t priority);
+
+static task_id_t _task_pop_new_work();
+
+static void _run_task(task_id_t t);
+
+static inline uint64_t _trace_begin() {
+    if (!atomic_load_explicit(&_G.trace, memory_order_relaxed)) {
+        return 0;
+    }
+
+    return ct_os_a0->time->perf_counter();
+}
+
+// Only workers and main thread have own buffer.
+static void _trace_event(uint32_t type,
+                         const char *name,
+                         uint64_t begin) {
+    if (!atomic_load_explicit(&_G.trace, memory_order_acquire) ||
+        !_has_queue || !begin) {
+        return;
+    }
+
+    struct trace_buffer *buffer = &_G.worker[_worker_id].trace;
+
+    uint32_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+    buffer->events[head & (TRACE_BUFFER_SIZE - 1)] = (struct trace_event) {
+            .begin = begin,
+            .end = ct_os_a0->time->perf_counter(),
+            .name = name ? name : "task",
+            .type = type,
+    };
+
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+static inline struct task_t *_task(uint32_t idx) {
+    return pool_paged_get(&_G.task_pool, idx);
+}
+
+static inline struct counter_t *_counter(uint32_t idx) {
+    return pool_paged_get(&_G.counter_pool, idx);
+}
+
+// Queue or pool is full, wake everybody and help until running tasks
+// free some space.
+static void _help_full(uint8_t priority) {
+    _wake_workers(_G.workers_count, priority);
+
+    task_id_t work = _task_pop_new_work();
+
+    if (work.id) {
+        _run_task(work);
+    } else {
+        ct_os_a0->thread->yield();
+    }
+}
+
 static task_id_t _new_task() {
-    uint32_t idx;
-    queue_task_pop(&_G.free_task, &idx, UINT32_MAX);
+    uint32_t idx = pool_paged_alloc(&_G.task_pool);
 
-    if (idx == UINT32_MAX) {
-        idx = atomic_fetch_add(&_G.task_pool_idx, 1);
+    while (!idx) {
+        _help_full(TASK_PRIORITY_NORMAL);
+        idx = pool_paged_alloc(&_G.task_pool);
     }
 
     return make_task(idx);
 }
 
+static void _new_task_n(uint32_t *idx,
+                        uint32_t n) {
+    uint32_t allocated = pool_paged_alloc_n(&_G.task_pool, idx, n);
+
+    while (allocated != n) {
+        _help_full(TASK_PRIORITY_NORMAL);
+        allocated += pool_paged_alloc_n(&_G.task_pool, idx + allocated,
+                                        n - allocated);
+    }
+}
+
 static uint32_t _new_counter_task(uint32_t value) {
-    uint32_t idx;
-    queue_task_pop(&_G.free_counter, &idx, UINT32_MAX);
+    uint32_t idx = pool_paged_alloc(&_G.counter_pool);
 
-    if (idx == UINT32_MAX) {
-        idx = atomic_fetch_add(&_G.counter_pool_idx, 1);
+    while (!idx) {
+        _help_full(TASK_PRIORITY_NORMAL);
+        idx = pool_paged_alloc(&_G.counter_pool);
     }
 
-    atomic_int *counter = &_G.counter_pool[idx];
-    atomic_init(counter, value);
+    struct counter_t *counter = _counter(idx);
+    atomic_init(&counter->value, value);
+    atomic_init(&counter->continuation, value ? 0 : COUNTER_FIRED);
+    atomic_init(&counter->wake_value, WAKE_NONE);
+    counter->idx = idx;
+    counter->release_on_fire = false;
 
     return idx;
 }
 
+static void _free_counter(uint32_t idx) {
+    pool_paged_free(&_G.counter_pool, idx);
+}
+
+// Priority indexes lanes, item with bad priority run as normal.
+static uint8_t _item_priority(const struct ct_task_item *item) {
+    if ((uint32_t) item->priority < TASK_PRIORITY_COUNT) {
+        return (uint8_t) item->priority;
+    }
+
+    ct_log_a0->error(LOG_WHERE, "Task %s has invalid priority %d",
+                     item->name, item->priority);
+    CETECH_ASSERT(LOG_WHERE, false);
+
+    return TASK_PRIORITY_NORMAL;
+}
+
+static task_id_t _new_task_from_item(const struct ct_task_item *item,
+                                     uint32_t counter) {
+    task_id_t task = _new_task();
+
+    *_task(task.id) = (struct task_t) {
+            .name = item->name,
+            .task_work = item->work,
+            .data = item->data,
+            .counter = counter,
+            .priority = _item_priority(item),
+    };
+
+    return task;
+}
+
+static void _push_task_n(uint8_t lane,
+                         const uint32_t *tasks,
+                         uint32_t n) {
+    if (_has_queue) {
+        struct queue_ws *q = &_G.worker[_worker_id].queue[lane];
+
+        const uint32_t pushed = queue_ws_push_n(q, tasks, n);
+        tasks += pushed;
+        n -= pushed;
+    }
+
+    while (n) {
+        const uint32_t pushed = queue_task_push_n(&_G.job_queue[lane], tasks, n);
+        tasks += pushed;
+        n -= pushed;
+
+        if (!n || pushed) {
+            continue;
+        }
+
+        _help_full(lane);
+    }
+}
+
 static void _push_task(task_id_t t) {
-    struct queue_mpmc *q;
-    q = &_G.job_queue;
+    _push_task_n(_task(t.id)->priority, &t.id, 1);
+}
 
-    queue_task_push(q, t.id);
+static bool _is_reserved() {
+    return (_worker_id != TASK_WORKER_MAIN) &&
+           (_worker_id <= _G.reserved_workers);
 }
 
+// Reserved workers skip background lane.
+static uint32_t _lane_count(bool reserved) {
+    return reserved ? TASK_PRIORITY_COUNT - 1 : TASK_PRIORITY_COUNT;
+}
 
-static task_id_t _try_pop(struct queue_mpmc *q) {
-    uint32_t poped_task;
+// Counter only go down, waiter can miss exact value.
+static bool _counter_reached(struct counter_t *counter,
+                             int32_t value) {
+    if (atomic_load_explicit(&counter->value, memory_order_acquire) > value) {
+        return false;
+    }
+
+    // Zero counter is done after it fired continuations.
+    return value || (COUNTER_FIRED == atomic_load_explicit(&counter->continuation,
+                                                           memory_order_acquire));
+}
+
+// Worker must poll if some fiber is ready.
+static bool _fiber_need_poll() {
+    if (!_G.use_fibers || (_worker_id == TASK_WORKER_MAIN)) {
+        return false;
+    }
+
+    struct worker_fibers *wf = &_G.fibers[_worker_id];
+
+    const uint32_t wait_n = ct_array_size(wf->wait_fiber);
+    for (uint32_t i = 0; i < wait_n; ++i) {
+        struct task_fiber *f = &wf->fiber[wf->wait_fiber[i]];
+
+        if (_counter_reached(f->wait_counter, f->wait_value)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool _has_work(bool reserved) {
+    if (_fiber_need_poll()) {
+        return true;
+    }
+
+    const uint32_t lane_n = _lane_count(reserved);
+
+    for (uint32_t l = 0; l < lane_n; ++l) {
+        const uint8_t lane = _lane_order[l];
+
+        if (queue_task_size(&_G.job_queue[lane])) {
+            return true;
+        }
+
+        for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+            if (queue_ws_size(&_G.worker[i].queue[lane])) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool _wake_group(struct sleep_group *group) {
+    int sleeping = atomic_load(&group->sleeping);
+    while (sleeping > 0) {
+        if (atomic_compare_exchange_weak(&group->sleeping, &sleeping,
+                                         sleeping - 1)) {
+            ct_os_a0->thread->sem_post(group->sem);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Wake up to n sleeping workers that can run priority work.
+static void _wake_workers(uint32_t n,
+                          uint8_t priority) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (n) {
+        // Prefer reserved workers, keep others free for background work.
+        if ((priority != TASK_PRIORITY_BACKGROUND) &&
+            _wake_group(&_G.sleep[SLEEP_GROUP_RESERVED])) {
+            --n;
+            continue;
+        }
+
+        if (_wake_group(&_G.sleep[SLEEP_GROUP_ANY])) {
+            --n;
+            continue;
+        }
+
+        break;
+    }
+}
+
+static void _park_worker() {
+    const bool reserved = _is_reserved();
+    struct sleep_group *group = &_G.sleep[reserved ? SLEEP_GROUP_RESERVED
+                                                   : SLEEP_GROUP_ANY];
+
+    atomic_fetch_add(&group->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    const uint64_t begin = _trace_begin();
+
+    if (!_has_work(reserved) && atomic_load(&_G.is_running)) {
+        ct_os_a0->thread->sem_wait(group->sem);
+        _trace_event(TRACE_IDLE, "idle", begin);
+        return;
+    }
+
+    // Work arrived, cancel sleep if nobody wake us already.
+    int sleeping = atomic_load(&group->sleeping);
+    while (sleeping > 0) {
+        if (atomic_compare_exchange_weak(&group->sleeping, &sleeping,
+                                         sleeping - 1)) {
+            return;
+        }
+    }
+
+    ct_os_a0->thread->sem_wait(group->sem);
+    _trace_event(TRACE_IDLE, "idle", begin);
+}
+
+// Push task list linked by next and wake workers for each lane.
+static void _push_task_list(uint32_t t) {
+    uint32_t lane_n[TASK_PRIORITY_COUNT] = {};
+
+    while (t) {
+        uint32_t next = _task(t)->next;
+        ++lane_n[_task(t)->priority];
+        _push_task(make_task(t));
+        t = next;
+    }
+
+    for (uint32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+        _wake_workers(lane_n[i], (uint8_t) i);
+    }
+}
+
+// Schedule all continuations waiting for counter.
+// Waiter can release counter right after exchange, do not touch it then.
+static void _counter_fire(uint32_t counter_idx) {
+    struct counter_t *counter = _counter(counter_idx);
+    const bool release = counter->release_on_fire;
+
+    uint32_t t = atomic_exchange(&counter->continuation, COUNTER_FIRED);
+
+    if (release) {
+        _free_counter(counter_idx);
+    }
+
+    // Fiber waiting for this counter can be on sleeping worker.
+    if (atomic_load(&_G.fiber_waiting)) {
+        _wake_workers(_G.workers_count, TASK_PRIORITY_NORMAL);
+    }
+
+    if (t) {
+        _push_task_list(t);
+    }
+}
+
+static void _counter_done(uint32_t counter_idx) {
+    struct counter_t *c = _counter(counter_idx);
+    const int32_t value = atomic_fetch_sub(&c->value, 1) - 1;
+
+    if (!value) {
+        _counter_fire(counter_idx);
+        return;
+    }
+
+    // Fiber waiting for nonzero value can be on sleeping worker.
+    const int32_t wake = atomic_load(&c->wake_value);
+    if ((wake == value) || (wake == WAKE_ANY)) {
+        _wake_workers(_G.workers_count, TASK_PRIORITY_NORMAL);
+    }
+}
+
+// Link task list first..last as continuation of counter.
+// Return false if counter already fired, list is not linked then.
+static bool _counter_after(struct counter_t *counter,
+                           uint32_t first,
+                           uint32_t last) {
+    uint32_t head = atomic_load(&counter->continuation);
+    while (head != COUNTER_FIRED) {
+        _task(last)->next = head;
+
+        if (atomic_compare_exchange_weak(&counter->continuation, &head,
+                                         first)) {
+            return true;
+        }
+    }
+
+    _task(last)->next = 0;
+    return false;
+}
+
+// Take batch from shared queue, keep first and move rest to own queue
+// where others can steal it.
+static task_id_t _try_pop(uint8_t lane) {
+    struct queue_mpmc *q = &_G.job_queue[lane];
 
     if (!queue_task_size(q)) {
         return task_null;
     }
 
-    if (queue_task_pop(q, &poped_task, 0)) {
-        if (poped_task != 0) {
+    uint32_t poped_task[POP_BATCH];
+    const uint32_t n = queue_task_pop_n(q, poped_task,
+                                        _has_queue ? POP_BATCH : 1);
+
+    if (!n) {
+        return task_null;
+    }
+
+    if (n > 1) {
+        _push_task_n(lane, &poped_task[1], n - 1);
+        _wake_workers(n - 1, lane);
+    }
+
+    return make_task(poped_task[0]);
+}
+
+static task_id_t _try_steal(uint8_t lane) {
+    const uint32_t queue_n = _G.workers_count + 1;
+
+    uint32_t poped_task;
+    for (uint32_t i = 1; i < queue_n; ++i) {
+        const uint32_t victim = (_worker_id + i) % queue_n;
+
+        if (queue_ws_steal(&_G.worker[victim].queue[lane], &poped_task)) {
+            _trace_event(TRACE_STEAL, _task(poped_task)->name,
+                         _trace_begin());
             return make_task(poped_task);
         }
     }
@@ -118,49 +638,237 @@ static task_id_t _try_pop(struct queue_mpmc *q) {
     return task_null;
 }
 
+// Drain lanes from highest priority: own queue, shared queue, steal.
 static task_id_t _task_pop_new_work() {
     task_id_t pop_task;
-    struct queue_mpmc *qg = &_G.job_queue;
 
-    pop_task = _try_pop(qg);
-    if (pop_task.id != 0) {
-        return pop_task;
+    const uint32_t lane_n = _lane_count(_is_reserved());
+    for (uint32_t l = 0; l < lane_n; ++l) {
+        const uint8_t lane = _lane_order[l];
+
+        if (_has_queue) {
+            uint32_t poped_task;
+            if (queue_ws_pop(&_G.worker[_worker_id].queue[lane],
+                             &poped_task)) {
+                return make_task(poped_task);
+            }
+        }
+
+        pop_task = _try_pop(lane);
+        if (pop_task.id != 0) {
+            return pop_task;
+        }
+
+        pop_task = _try_steal(lane);
+        if (pop_task.id != 0) {
+            return pop_task;
+        }
     }
 
     return task_null;
 }
 
 
-int do_work() {
+static void _run_task(task_id_t t) {
+    struct task_t *task = _task(t.id);
+
+    const uint8_t prev_priority = _task_priority;
+    _task_priority = task->priority;
+
+    const uint64_t begin = _trace_begin();
+    task->task_work(task->data);
+    _trace_event(TRACE_TASK, task->name, begin);
+
+    _task_priority = prev_priority;
+
+    const uint32_t counter = task->counter;
+    pool_paged_free(&_G.task_pool, t.id);
+
+    _counter_done(counter);
+}
+
+static void _fiber_main() {
+    struct worker_fibers *wf = &_G.fibers[_worker_id];
+
+    while (true) {
+        struct task_fiber *f = _current_fiber;
+
+        _run_task(f->task);
+
+        ct_array_push(wf->free_fiber, f - wf->fiber, _G.allocator);
+        fiber_switch(&f->fiber, &wf->scheduler);
+    }
+}
+
+static struct task_fiber *_fiber_get(struct worker_fibers *wf) {
+    if (ct_array_any(wf->free_fiber)) {
+        uint32_t idx = ct_array_back(wf->free_fiber);
+        ct_array_pop_back(wf->free_fiber);
+        return &wf->fiber[idx];
+    }
+
+    if (wf->fiber_n < MAX_FIBERS) {
+        struct task_fiber *f = &wf->fiber[wf->fiber_n++];
+        fiber_create(&f->fiber, FIBER_STACK_SIZE, _fiber_main, _G.allocator);
+        return f;
+    }
+
+    return NULL;
+}
+
+// Run fiber until it finish task or wait.
+static void _fiber_resume(struct worker_fibers *wf,
+                          struct task_fiber *f) {
+    const uint8_t priority = _task_priority;
+
+    _current_fiber = f;
+    fiber_switch(&wf->scheduler, &f->fiber);
+    _current_fiber = NULL;
+
+    _task_priority = priority;
+}
+
+static int _fiber_do_work() {
+    struct worker_fibers *wf = &_G.fibers[_worker_id];
+
+    const uint32_t wait_n = ct_array_size(wf->wait_fiber);
+    for (uint32_t i = 0; i < wait_n; ++i) {
+        struct task_fiber *f = &wf->fiber[wf->wait_fiber[i]];
+
+        if (!_counter_reached(f->wait_counter, f->wait_value)) {
+            continue;
+        }
+
+        wf->wait_fiber[i] = wf->wait_fiber[wait_n - 1];
+        ct_array_pop_back(wf->wait_fiber);
+        atomic_fetch_sub(&_G.fiber_waiting, 1);
+
+        _fiber_resume(wf, f);
+        return 1;
+    }
+
     task_id_t t = _task_pop_new_work();
 
     if (t.id == 0) {
         return 0;
     }
 
-    struct task_t *task = &_G.task_pool[t.id];
+    struct task_fiber *f = _fiber_get(wf);
+
+    // No free fiber, run nested on current stack.
+    if (!f) {
+        _run_task(t);
+        return 1;
+    }
+
+    f->task = t;
+    _fiber_resume(wf, f);
+    return 1;
+}
+
+// Main thread (and foreign threads) never suspend, fiber waiting there
+// would resume only when main call wait again.
+int do_work() {
+    if (_G.use_fibers && (_worker_id != TASK_WORKER_MAIN)) {
+        return _fiber_do_work();
+    }
 
-    task->task_work(_G.task_pool[t.id].data);
+    task_id_t t = _task_pop_new_work();
 
-    atomic_fetch_sub(&_G.counter_pool[task->counter], 1);
-    queue_task_push(&_G.free_task, t.id);
+    if (t.id == 0) {
+        return 0;
+    }
 
+    _run_task(t);
     return 1;
 }
 
-static int _task_worker(void *o) {
-    // Wait for run signal 0 -> 1
-    while (!_G.is_running) {
+// Suspend current fiber until counter reach value.
+static void _fiber_wait(struct task_fiber *fiber,
+                        struct counter_t *counter,
+                        int32_t value) {
+    struct worker_fibers *wf = &_G.fibers[_worker_id];
+
+    fiber->wait_counter = counter;
+    fiber->wait_value = value;
+
+    if (value) {
+        int wake = WAKE_NONE;
+        if (!atomic_compare_exchange_strong(&counter->wake_value, &wake,
+                                            value) && (wake != value)) {
+            atomic_store(&counter->wake_value, WAKE_ANY);
+        }
     }
 
-    _worker_id = (char) (uint64_t) o;
+    ct_array_push(wf->wait_fiber, fiber - wf->fiber, _G.allocator);
+    atomic_fetch_add(&_G.fiber_waiting, 1);
+
+    const uint8_t priority = _task_priority;
+    fiber_switch(&fiber->fiber, &wf->scheduler);
+    _task_priority = priority;
+}
+
+// Pin worker to own core and/or to cpus of NUMA node.
+// Workers are spread round-robin over nodes, first main_threads cores of
+// node 0 are left for main threads.
+static void _pin_worker(uint32_t worker) {
+    if (!_G.affinity && !_G.numa) {
+        return;
+    }
+
+    uint32_t cpus[MAX_PIN_CPUS];
+    uint32_t cpu_n;
+
+    uint32_t node = 0;
+    uint32_t slot = worker - 1;
+
+    if (_G.numa) {
+        const uint32_t node_n = ct_os_a0->cpu->numa_node_count();
+        node = slot % node_n;
+        slot = slot / node_n;
+    }
+
+    cpu_n = ct_os_a0->cpu->numa_node_cpus(node, cpus, CT_ARRAY_LEN(cpus));
+    if (!cpu_n) {
+        return;
+    }
+
+    bool ok;
+    if (_G.affinity) {
+        const uint32_t skip = node ? 0 : _G.main_threads;
+        ok = ct_os_a0->thread->set_affinity(&cpus[(slot + skip) % cpu_n], 1);
+    } else {
+        ok = ct_os_a0->thread->set_affinity(cpus, cpu_n);
+    }
+
+    if (!ok) {
+        ct_log_a0->warning(LOG_WHERE, "Could not pin worker %u", worker);
+    }
+}
+
+static int _task_worker(void *o) {
+    _worker_id = (uint8_t) (uint64_t) o;
+    _has_queue = true;
+
+    _pin_worker(_worker_id);
 
     ct_log_a0->debug("task_worker", "Worker %d init", _worker_id);
 
-    while (_G.is_running) {
-        if (!do_work()) {
+    uint32_t spin = 0;
+    while (atomic_load(&_G.is_running)) {
+        if (do_work()) {
+            spin = 0;
+            continue;
+        }
+
+        if (spin < _G.spin_budget) {
+            ++spin;
             ct_os_a0->thread->yield();
+            continue;
         }
+
+        _park_worker();
+        spin = 0;
     }
 
     ct_log_a0->debug("task_worker", "Worker %d shutdown", _worker_id);
@@ -177,32 +885,333 @@ void add(struct ct_task_item *items,
          struct ct_task_counter_t **counter) {
     uint32_t new_counter = _new_counter_task(count);
 
-    *counter = (struct ct_task_counter_t *) &_G.counter_pool[new_counter];
+    *counter = (struct ct_task_counter_t *) _counter(new_counter);
 
-    for (uint32_t i = 0; i < count; ++i) {
-        task_id_t task = _new_task();
-        _G.task_pool[task.id] = (struct task_t) {
-                .name = items[i].name,
-                .task_work = items[i].work,
-                .counter = new_counter
-        };
+    uint32_t lane_n[TASK_PRIORITY_COUNT] = {};
+    uint32_t tasks[ADD_BATCH];
+
+    for (uint32_t i = 0; i < count; i += ADD_BATCH) {
+        const uint32_t n = (count - i) < ADD_BATCH ? (count - i) : ADD_BATCH;
+        struct ct_task_item *batch = &items[i];
+
+        _new_task_n(tasks, n);
 
-        _G.task_pool[task.id].data = items[i].data;
+        for (uint32_t j = 0; j < n; ++j) {
+            *_task(tasks[j]) = (struct task_t) {
+                    .name = batch[j].name,
+                    .task_work = batch[j].work,
+                    .data = batch[j].data,
+                    .counter = new_counter,
+                    .priority = _item_priority(&batch[j]),
+            };
+
+            ++lane_n[_task(tasks[j])->priority];
+        }
+
+        // Push runs with same priority at once.
+        uint32_t run = 0;
+        for (uint32_t j = 1; j <= n; ++j) {
+            const uint8_t lane = _task(tasks[run])->priority;
+
+            if ((j == n) || (_task(tasks[j])->priority != lane)) {
+                _push_task_n(lane, &tasks[run], j - run);
+                run = j;
+            }
+        }
+    }
 
-        _push_task(task);
+    for (uint32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+        _wake_workers(lane_n[i], (uint8_t) i);
     }
 }
 
+// Join task only count down join counter.
+static void _join_work(void *data) {
+    CT_UNUSED(data);
+}
+
+void add_after(struct ct_task_item *items,
+               uint32_t count,
+               struct ct_task_counter_t **dependencies,
+               uint32_t dependency_count,
+               struct ct_task_counter_t **counter) {
+    CETECH_ASSERT(LOG_WHERE, count > 0);
+
+    uint32_t new_counter = _new_counter_task(count);
+
+    *counter = (struct ct_task_counter_t *) _counter(new_counter);
+
+    task_id_t first = task_null;
+    task_id_t last = task_null;
+    for (uint32_t i = 0; i < count; ++i) {
+        task_id_t task = _new_task_from_item(&items[i], new_counter);
+        _task(task.id)->next = first.id;
+
+        if (!last.id) {
+            last = task;
+        }
+
+        first = task;
+    }
+
+    if (!dependency_count) {
+        _push_task_list(first.id);
+        return;
+    }
+
+    if (1 == dependency_count) {
+        struct counter_t *dep = (struct counter_t *) dependencies[0];
+
+        if (!_counter_after(dep, first.id, last.id)) {
+            _push_task_list(first.id);
+        }
+
+        return;
+    }
+
+    // Fan-in: tasks wait on join counter, every dependency run one join
+    // task that count it down.
+    const uint32_t join = _new_counter_task(dependency_count);
+    struct counter_t *join_counter = _counter(join);
+
+    join_counter->release_on_fire = true;
+    _task(last.id)->next = 0;
+    atomic_store(&join_counter->continuation, first.id);
+
+    const uint8_t priority = _task(first.id)->priority;
+
+    for (uint32_t i = 0; i < dependency_count; ++i) {
+        struct counter_t *dep = (struct counter_t *) dependencies[i];
+        task_id_t join_task = _new_task();
+
+        *_task(join_task.id) = (struct task_t) {
+                .name = "join",
+                .task_work = _join_work,
+                .counter = join,
+                .priority = priority,
+        };
+
+        if (!_counter_after(dep, join_task.id, join_task.id)) {
+            // Dependency is already done.
+            pool_paged_free(&_G.task_pool, join_task.id);
+            _counter_done(join);
+        }
+    }
+}
 
 void wait_atomic(struct ct_task_counter_t *signal,
                  int32_t value) {
-    while (atomic_load_explicit((atomic_int *) signal, memory_order_acquire) !=
-           value) {
-        do_work();
+    struct counter_t *counter = (struct counter_t *) signal;
+
+    if (!_counter_reached(counter, value)) {
+        const uint64_t begin = _trace_begin();
+
+        if (_current_fiber) {
+            _fiber_wait(_current_fiber, counter, value);
+        }
+
+        while (!_counter_reached(counter, value)) {
+            do_work();
+        }
+
+        _trace_event(TRACE_WAIT, "wait", begin);
     }
 
-    uint32_t counter_idx = ((atomic_int *) signal) - _G.counter_pool;
-    queue_task_push(&_G.free_counter, counter_idx);
+    // Tasks still decrement counter, caller must wait for zero too.
+    if (!value) {
+        _free_counter(counter->idx);
+    }
+}
+
+static void _parallel_for_split(struct parallel_for *pf,
+                                uint32_t begin,
+                                uint32_t end);
+
+static void _parallel_for_task(void *data) {
+    struct parallel_for_range *range = data;
+    _parallel_for_split(range->pf, range->begin, range->end);
+}
+
+// Split range in half until grain, push right half and continue with left.
+static void _parallel_for_split(struct parallel_for *pf,
+                                uint32_t begin,
+                                uint32_t end) {
+    while ((end - begin) > pf->grain) {
+        const uint32_t mid = begin + ((end - begin) / 2);
+
+        uint32_t idx = atomic_fetch_add(&pf->range_n, 1);
+        pf->ranges[idx] = (struct parallel_for_range) {
+                .pf = pf,
+                .begin = mid,
+                .end = end,
+        };
+
+        struct ct_task_item item = {
+                .name = "parallel_for",
+                .work = _parallel_for_task,
+                .data = &pf->ranges[idx],
+                .priority = (enum ct_task_priority) _task_priority,
+        };
+
+        atomic_fetch_add(&_counter(pf->counter)->value, 1);
+        _push_task(_new_task_from_item(&item, pf->counter));
+        _wake_workers(1, _task_priority);
+
+        end = mid;
+    }
+
+    pf->work(begin, end, pf->data);
+}
+
+void parallel_for(uint32_t begin,
+                  uint32_t end,
+                  uint32_t grain,
+                  ct_task_range_work_t work,
+                  void *data) {
+    if (end <= begin) {
+        return;
+    }
+
+    const uint32_t n = end - begin;
+
+    // Max ~8 subranges per thread.
+    const uint32_t min_grain = n / (4 * (_G.workers_count + 1));
+    if (grain < min_grain) {
+        grain = min_grain;
+    }
+
+    if (!grain) {
+        grain = 1;
+    }
+
+    if ((n <= grain) || !_G.workers_count) {
+        work(begin, end, data);
+        return;
+    }
+
+    // Time small probe range first, whole range that is cheaper than
+    // dispatch and wake of workers run serial.
+    const uint32_t probe_n = (n / PARALLEL_FOR_PROBE_DIV) ?
+                             (n / PARALLEL_FOR_PROBE_DIV) : 1;
+
+    const uint64_t probe_begin = ct_os_a0->time->perf_counter();
+    work(begin, begin + probe_n, data);
+    const uint64_t probe_ticks = ct_os_a0->time->perf_counter() - probe_begin;
+
+    begin += probe_n;
+
+    if ((probe_ticks * (n / probe_n)) < _G.parallel_for_serial_ticks) {
+        work(begin, end, data);
+        return;
+    }
+
+    const uint32_t max_ranges = (2 * (n / grain)) + 2;
+
+    struct parallel_for pf = {
+            .work = work,
+            .data = data,
+            .grain = grain,
+            .counter = _new_counter_task(1),
+            .ranges = CT_ALLOC(_G.allocator, struct parallel_for_range,
+                               sizeof(struct parallel_for_range) * max_ranges),
+    };
+
+    atomic_init(&pf.range_n, 0);
+
+    _parallel_for_split(&pf, begin, end);
+
+    if (1 == atomic_fetch_sub(&_counter(pf.counter)->value, 1)) {
+        _counter_fire(pf.counter);
+    }
+
+    wait_atomic((struct ct_task_counter_t *) _counter(pf.counter), 0);
+
+    CT_FREE(_G.allocator, pf.ranges);
+}
+
+static const char *_trace_event_str[] = {
+        [TRACE_TASK] = "task",
+        [TRACE_WAIT] = "wait",
+        [TRACE_IDLE] = "idle",
+        [TRACE_STEAL] = "steal",
+};
+
+void trace_dump(const char *filename) {
+    if (!_G.worker[0].trace.events) {
+        ct_log_a0->warning(LOG_WHERE, "Trace is not enabled");
+        return;
+    }
+
+    struct ct_vio *f = ct_os_a0->vio->from_file(filename, VIO_OPEN_WRITE);
+    if (!f) {
+        ct_log_a0->error(LOG_WHERE, "Could not open trace file %s", filename);
+        return;
+    }
+
+    const double to_us = 1e6 / ct_os_a0->time->perf_freq();
+
+    // Find first event to make timestamps small.
+    uint64_t base = UINT64_MAX;
+    for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+        struct trace_buffer *buffer = &_G.worker[i].trace;
+        const uint32_t head = atomic_load(&buffer->head);
+        const uint32_t n = head < TRACE_BUFFER_SIZE ? head : TRACE_BUFFER_SIZE;
+
+        for (uint32_t j = head - n; j != head; ++j) {
+            struct trace_event *ev;
+            ev = &buffer->events[j & (TRACE_BUFFER_SIZE - 1)];
+
+            base = ev->begin < base ? ev->begin : base;
+        }
+    }
+
+    char *buf = NULL;
+    ct_buffer_printf(&buf, _G.allocator, "{\"traceEvents\":[\n");
+
+    for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+        ct_buffer_printf(&buf, _G.allocator,
+                         "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+                         "\"tid\":%u,\"args\":{\"name\":\"%s %u\"}},\n",
+                         i, i ? "worker" : "main", i);
+
+        struct trace_buffer *buffer = &_G.worker[i].trace;
+        const uint32_t head = atomic_load(&buffer->head);
+        const uint32_t n = head < TRACE_BUFFER_SIZE ? head : TRACE_BUFFER_SIZE;
+
+        for (uint32_t j = head - n; j != head; ++j) {
+            struct trace_event *ev;
+            ev = &buffer->events[j & (TRACE_BUFFER_SIZE - 1)];
+
+            const double ts = (ev->begin - base) * to_us;
+
+            if (ev->type == TRACE_STEAL) {
+                ct_buffer_printf(&buf, _G.allocator,
+                                 "{\"name\":\"steal %s\",\"cat\":\"%s\","
+                                 "\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                                 "\"pid\":0,\"tid\":%u},\n",
+                                 ev->name, _trace_event_str[ev->type], ts, i);
+                continue;
+            }
+
+            ct_buffer_printf(&buf, _G.allocator,
+                             "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                             "\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u},\n",
+                             ev->name, _trace_event_str[ev->type], ts,
+                             (ev->end - ev->begin) * to_us, i);
+        }
+    }
+
+    // Metadata event to close list without trailing comma.
+    ct_buffer_printf(&buf, _G.allocator,
+                     "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                     "\"args\":{\"name\":\"cetech\"}}\n]}\n");
+
+    f->write(f, buf, sizeof(char), ct_buffer_size(buf));
+    f->close(f);
+
+    ct_buffer_free(buf, _G.allocator);
+
+    ct_log_a0->info(LOG_WHERE, "Trace dumped to %s", filename);
 }
 
 char worker_id() {
@@ -213,58 +1222,267 @@ int worker_count() {
     return _G.workers_count;
 }
 
+void start();
+
 static struct ct_task_a0 _task_api = {
+        .start = start,
         .worker_id = worker_id,
         .worker_count = worker_count,
         .add = add,
-        .wait_for_counter = wait_atomic
+        .add_after = add_after,
+        .parallel_for = parallel_for,
+        .wait_for_counter = wait_atomic,
+        .trace_dump = trace_dump,
 };
 
 struct ct_task_a0 *ct_task_a0 = &_task_api;
 
+static void _load_config() {
+    _G.spin_budget = ct_cdb_a0->read_uint64(_G.config,
+                                            CONFIG_TASK_SPIN_BUDGET,
+                                            DEFAULT_SPIN_BUDGET);
+
+    uint32_t reserved = ct_cdb_a0->read_uint64(_G.config,
+                                               CONFIG_TASK_RESERVED_WORKERS,
+                                               DEFAULT_RESERVED_WORKERS);
+
+    // Keep at least one worker for background work.
+    const uint32_t max_reserved = _G.workers_count ? _G.workers_count - 1 : 0;
+    _G.reserved_workers = reserved < max_reserved ? reserved : max_reserved;
+
+    const bool trace = ct_cdb_a0->read_uint64(_G.config, CONFIG_TASK_TRACE,
+                                              DEFAULT_TRACE) > 0;
+
+    // Buffers live until shutdown, dump can be called after disable.
+    // Workers created by start get buffers on next load.
+    if (trace) {
+        for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+            if (_G.worker[i].trace.events) {
+                continue;
+            }
+
+            _G.worker[i].trace.events = CT_ALLOC(_G.allocator,
+                                                 struct trace_event,
+                                                 sizeof(struct trace_event) *
+                                                 TRACE_BUFFER_SIZE);
+            atomic_init(&_G.worker[i].trace.head, 0);
+        }
+    }
+
+    atomic_store_explicit(&_G.trace, trace, memory_order_release);
+}
+
+static void _on_config_change(uint64_t obj,
+                              const uint64_t *prop,
+                              uint32_t prop_count,
+                              void *data) {
+    CT_UNUSED(obj, prop, prop_count, data);
+    _load_config();
+}
+
+static const struct {
+    uint64_t key;
+    uint64_t value;
+} _config_defaults[] = {
+        {CONFIG_TASK_SPIN_BUDGET,      DEFAULT_SPIN_BUDGET},
+        {CONFIG_TASK_RESERVED_WORKERS, DEFAULT_RESERVED_WORKERS},
+        {CONFIG_TASK_FIBERS,           DEFAULT_FIBERS},
+        {CONFIG_TASK_TRACE,            DEFAULT_TRACE},
+        {CONFIG_TASK_WORKER_COUNT,     DEFAULT_WORKER_COUNT},
+        {CONFIG_TASK_MAIN_THREADS,     DEFAULT_MAIN_THREADS},
+        {CONFIG_TASK_AFFINITY,         DEFAULT_AFFINITY},
+        {CONFIG_TASK_NUMA,             DEFAULT_NUMA},
+};
+
+static void _init_config() {
+    _G.config = ct_config_a0->obj();
+
+    ct_cdb_obj_o *writer = ct_cdb_a0->write_begin(_G.config);
+
+    for (uint32_t i = 0; i < CT_ARRAY_LEN(_config_defaults); ++i) {
+        if (!ct_cdb_a0->prop_exist(_G.config, _config_defaults[i].key)) {
+            ct_cdb_a0->set_uint64(writer, _config_defaults[i].key,
+                                  _config_defaults[i].value);
+        }
+    }
+
+    ct_cdb_a0->write_commit(writer);
+}
+
+static uint32_t _worker_count() {
+    const int core_count = ct_os_a0->cpu->count();
+
+    uint64_t worker_count = ct_cdb_a0->read_uint64(_G.config,
+                                                   CONFIG_TASK_WORKER_COUNT,
+                                                   DEFAULT_WORKER_COUNT);
+
+    // Auto, keep cores for main threads but use at least one worker.
+    if (!worker_count) {
+        const int count = core_count - (int) _G.main_threads;
+        worker_count = count > 1 ? count : 1;
+    }
+
+    if (worker_count > TASK_MAX_WORKERS - 1) {
+        worker_count = TASK_MAX_WORKERS - 1;
+    }
+
+    ct_log_a0->info(LOG_WHERE, "Core/Main/Worker: %d, %u, %u",
+                    core_count, _G.main_threads, (uint32_t) worker_count);
+
+    return (uint32_t) worker_count;
+}
+
+// Workers are created by start, until then main thread run all tasks.
 static void _init(struct ct_api_a0 *api) {
-    _G = (struct _G) {.allocator = ct_memory_a0->system};
+    _G = (struct _G) {
+            .allocator = ct_memory_a0->system,
+            .parallel_for_serial_ticks = (PARALLEL_FOR_SERIAL_NS *
+                                          ct_os_a0->time->perf_freq()) /
+                                         1000000000ULL,
+    };
 
     api->register_api("ct_task_a0", &_task_api);
 
-    int core_count = ct_os_a0->cpu->count();
+    _init_config();
+
+    _G.worker = CT_ALLOC(_G.allocator, struct worker_t,
+                         sizeof(struct worker_t));
+    _G.worker[0] = (struct worker_t) {};
+
+    pool_paged_init(&_G.task_pool, sizeof(struct task_t), _G.allocator);
+    pool_paged_init(&_G.counter_pool, sizeof(struct counter_t), _G.allocator);
+
+    for (int l = 0; l < TASK_PRIORITY_COUNT; ++l) {
+        queue_task_init(&_G.job_queue[l], QUEUE_SIZE, _G.allocator);
+        queue_ws_init(&_G.worker[0].queue[l], QUEUE_SIZE, _G.allocator);
+    }
+
+    atomic_init(&_G.fiber_waiting, 0);
+
+    _worker_id = TASK_WORKER_MAIN;
+    _has_queue = true;
+
+    for (int i = 0; i < SLEEP_GROUP_COUNT; ++i) {
+        _G.sleep[i].sem = ct_os_a0->thread->sem_create(0);
+        atomic_init(&_G.sleep[i].sleeping, 0);
+    }
+    atomic_init(&_G.is_running, 1);
+
+    _load_config();
+
+    ct_cdb_a0->register_notify(_G.config, _on_config_change, NULL);
+}
+
+void start() {
+    if (_G.started) {
+        return;
+    }
+
+    _G.started = true;
+
+    _G.main_threads = ct_cdb_a0->read_uint64(_G.config,
+                                             CONFIG_TASK_MAIN_THREADS,
+                                             DEFAULT_MAIN_THREADS);
+
+    _G.affinity = ct_cdb_a0->read_uint64(_G.config, CONFIG_TASK_AFFINITY,
+                                         DEFAULT_AFFINITY) > 0;
 
-    static const uint32_t main_threads_count = 1 + 1/* Renderer */;
-    const uint32_t worker_count = core_count - main_threads_count;
+    _G.numa = ct_cdb_a0->read_uint64(_G.config, CONFIG_TASK_NUMA,
+                                     DEFAULT_NUMA) > 0;
 
-    ct_log_a0->info("task", "Core/Main/Worker: %d, %d, %d",
-                    core_count, main_threads_count, worker_count);
+    const uint32_t worker_count = _worker_count();
 
+    // Only main thread run now, its queues keep pending tasks.
+    struct worker_t *worker = CT_ALLOC(_G.allocator, struct worker_t,
+                                       sizeof(struct worker_t) *
+                                       (worker_count + 1));
+
+    worker[0] = _G.worker[0];
+
+    for (uint32_t i = 1; i < worker_count + 1; ++i) {
+        worker[i] = (struct worker_t) {};
+
+        for (int l = 0; l < TASK_PRIORITY_COUNT; ++l) {
+            queue_ws_init(&worker[i].queue[l], QUEUE_SIZE, _G.allocator);
+        }
+    }
+
+    CT_FREE(_G.allocator, _G.worker);
+    _G.worker = worker;
     _G.workers_count = worker_count;
 
-    queue_task_init(&_G.job_queue, MAX_TASK, _G.allocator);
-    queue_task_init(&_G.free_task, MAX_TASK, _G.allocator);
-    queue_task_init(&_G.free_counter, MAX_TASK, _G.allocator);
+    _G.use_fibers = ct_cdb_a0->read_uint64(_G.config, CONFIG_TASK_FIBERS,
+                                           DEFAULT_FIBERS) > 0;
 
-    atomic_init(&_G.counter_pool_idx, 1);
-    atomic_init(&_G.task_pool_idx, 1);
+    if (_G.use_fibers) {
+        _G.fibers = CT_ALLOC(_G.allocator, struct worker_fibers,
+                             sizeof(struct worker_fibers) * (worker_count + 1));
 
-    for (uint32_t j = 0; j < worker_count; ++j) {
-        _G.workers[j] = ct_os_a0->thread->create(_task_worker,
-                                                    "cetech_worker",
-                                                    (void *) ((intptr_t) (j +
-                                                                          1)));
+        for (uint32_t i = 0; i < worker_count + 1; ++i) {
+            _G.fibers[i] = (struct worker_fibers) {};
+        }
     }
 
-    _G.is_running = 1;
+    // Reserved workers and trace buffers depend on worker count.
+    _load_config();
+
+    ct_log_a0->info(LOG_WHERE, "Fibers: %d, Affinity: %d, NUMA: %d",
+                    _G.use_fibers, _G.affinity, _G.numa);
+
+    for (uint32_t j = 1; j < worker_count + 1; ++j) {
+        _G.worker[j].thread = ct_os_a0->thread->create(_task_worker,
+                                                       "cetech_worker",
+                                                       (void *) ((intptr_t) j));
+    }
 }
 
 static void _shutdown() {
-    _G.is_running = 0;
+    atomic_store(&_G.is_running, 0);
+    _wake_workers(_G.workers_count, TASK_PRIORITY_NORMAL);
+
     int status = 0;
 
-    for (uint32_t i = 0; i < _G.workers_count; ++i) {
-        ct_os_a0->thread->wait(_G.workers[i], &status);
+    for (uint32_t i = 1; i < _G.workers_count + 1; ++i) {
+        ct_os_a0->thread->wait(_G.worker[i].thread, &status);
+    }
+
+    pool_paged_destroy(&_G.task_pool);
+    pool_paged_destroy(&_G.counter_pool);
+
+    for (uint32_t l = 0; l < TASK_PRIORITY_COUNT; ++l) {
+        queue_task_destroy(&_G.job_queue[l]);
+
+        for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+            queue_ws_destroy(&_G.worker[i].queue[l]);
+        }
+    }
+
+    for (uint32_t i = 0; i < SLEEP_GROUP_COUNT; ++i) {
+        ct_os_a0->thread->sem_destroy(_G.sleep[i].sem);
+    }
+
+    for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+        if (_G.worker[i].trace.events) {
+            CT_FREE(_G.allocator, _G.worker[i].trace.events);
+        }
+    }
+
+    if (_G.use_fibers) {
+        for (uint32_t i = 0; i < _G.workers_count + 1; ++i) {
+            struct worker_fibers *wf = &_G.fibers[i];
+
+            for (uint32_t j = 0; j < wf->fiber_n; ++j) {
+                fiber_destroy(&wf->fiber[j].fiber);
+            }
+
+            ct_array_free(wf->free_fiber, _G.allocator);
+            ct_array_free(wf->wait_fiber, _G.allocator);
+        }
+
+        CT_FREE(_G.allocator, _G.fibers);
     }
 
-    queue_task_destroy(&_G.job_queue);
-    queue_task_destroy(&_G.free_task);
-    queue_task_destroy(&_G.free_counter);
+    CT_FREE(_G.allocator, _G.worker);
 
     _G = (struct _G) {
             .allocator = ct_memory_a0->system
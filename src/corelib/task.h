@@ -8,21 +8,58 @@
 
 #include <stdatomic.h>
 
+//==============================================================================
+// Defines
+//==============================================================================
+
+//! Number of empty polls before idle worker sleep
+#define CONFIG_TASK_SPIN_BUDGET \
+    CT_ID64_0("task.spin_budget", 0x548f98e2f516dd6ULL)
+
+//! Number of workers that never run background tasks
+#define CONFIG_TASK_RESERVED_WORKERS \
+    CT_ID64_0("task.reserved_workers", 0x80472a37a8329a7dULL)
+
+//! Run tasks on fibers, waiting task suspend (read on start)
+#define CONFIG_TASK_FIBERS \
+    CT_ID64_0("task.fibers", 0xefeb31faa06ec96fULL)
+
+//! Record task trace to per worker buffers
+#define CONFIG_TASK_TRACE \
+    CT_ID64_0("task.trace", 0x8e372aa18abe65b4ULL)
+
+//! Worker count, 0 = cores - main_threads (read on start)
+#define CONFIG_TASK_WORKER_COUNT \
+    CT_ID64_0("task.worker_count", 0x237f1e83ad3b887ULL)
+
+//! Threads outside task system (main, renderer) (read on start)
+#define CONFIG_TASK_MAIN_THREADS \
+    CT_ID64_0("task.main_threads", 0xff838eb766d61353ULL)
+
+//! Pin each worker to own core (read on start)
+#define CONFIG_TASK_AFFINITY \
+    CT_ID64_0("task.affinity", 0x3a5b811e6b7aa1beULL)
+
+//! Spread workers over NUMA nodes and pin them to node cpus (read on start)
+#define CONFIG_TASK_NUMA \
+    CT_ID64_0("task.numa", 0x428e1cf66dfc6ccfULL)
+
 //==============================================================================
 // Enums
 //==============================================================================
 
 //! Worker enum
 enum ct_workers {
-    TASK_WORKER_MAIN = 0, //!< Main worker
-    TASK_WORKER1 = 1,     //!< Worker 1
-    TASK_WORKER2 = 2,     //!< Worker 2
-    TASK_WORKER3 = 3,     //!< Worker 3
-    TASK_WORKER4 = 4,     //!< Worker 4
-    TASK_WORKER5 = 5,     //!< Worker 5
-    TASK_WORKER6 = 6,     //!< Worker 6
-    TASK_WORKER7 = 7,     //!< Worker 7
-    TASK_MAX_WORKERS,     //!< Max workers
+    TASK_WORKER_MAIN = 0,    //!< Main worker
+    TASK_MAX_WORKERS = 128,  //!< Max workers (worker id is char)
+};
+
+//! Task priority
+enum ct_task_priority {
+    TASK_PRIORITY_NORMAL = 0,     //!< Normal work (default)
+    TASK_PRIORITY_FRAME,          //!< Frame critical work, run first
+    TASK_PRIORITY_BACKGROUND,     //!< Background work (compile, streaming)
+    TASK_PRIORITY_COUNT,          //!< Priority count
 };
 
 
@@ -31,20 +68,36 @@ enum ct_workers {
 //==============================================================================
 
 //! Task item struct
+//! Zero initialised item (or designated initializer without priority) run
+//! as TASK_PRIORITY_NORMAL. Priority out of range is error, task run as
+//! normal.
 struct ct_task_item {
     const char *name;               //!< Task name
     void (*work)(void *data);       //!< Task work
     void *data;                     //!< Worker data
+    enum ct_task_priority priority; //!< Task priority
 };
 
 struct ct_task_counter_t;
 
+//! Range work
+//! \param begin First item
+//! \param end Last item + 1
+//! \param data Work data
+typedef void (*ct_task_range_work_t)(uint32_t begin,
+                                     uint32_t end,
+                                     void *data);
+
 //==============================================================================
 // Api
 //==============================================================================
 
 //! Task API V0
 struct ct_task_a0 {
+    //! Create workers. Worker, placement and fiber config is read here, so
+    //! call it after config is loaded. Until start main thread run all tasks.
+    void (*start)();
+
     //! Workers count
     //! \return Workers count
     int (*worker_count)();
@@ -60,8 +113,46 @@ struct ct_task_a0 {
                 uint32_t count,
                 struct ct_task_counter_t **counter);
 
+    //! Add new tasks that run after all dependency counters reach zero
+    //! \param items Task item array
+    //! \param count Task item count (> 0)
+    //! \param dependencies Counters to wait for. Counters are not consumed,
+    //! one counter can be dependency of more add_after and caller still
+    //! release it with wait_for_counter(counter, 0).
+    //! \param dependency_count Dependency count (0 run tasks now)
+    //! \param counter New counter for added tasks
+    void (*add_after)(struct ct_task_item *items,
+                      uint32_t count,
+                      struct ct_task_counter_t **dependencies,
+                      uint32_t dependency_count,
+                      struct ct_task_counter_t **counter);
+
+    //! Run work over range [begin, end) splited to subranges and wait.
+    //! Small ranges or no workers run work inline. Subranges inherit
+    //! priority of calling task.
+    //! \param begin First item
+    //! \param end Last item + 1
+    //! \param grain Minimal subrange size
+    //! \param work Range work
+    //! \param data Work data
+    void (*parallel_for)(uint32_t begin,
+                         uint32_t end,
+                         uint32_t grain,
+                         ct_task_range_work_t work,
+                         void *data);
+
+    //! Wait until counter drop to value, counter is released when waited
+    //! for zero. In fiber mode waiting task on worker suspend and resume on
+    //! same worker, main thread run other tasks until counter is reached.
+    //! \param signal Counter
+    //! \param value Value
     void (*wait_for_counter)(struct ct_task_counter_t *signal,
                              int32_t value);
+
+    //! Dump recorded trace (task, wait, idle, steal) as Chrome trace json.
+    //! File can be opened in chrome://tracing or Perfetto.
+    //! \param filename Output file
+    void (*trace_dump)(const char *filename);
 };
 
 CT_MODULE(ct_task_a0);
@@ -0,0 +1,594 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <corelib/core.h>
+#include <corelib/log.h>
+#include <corelib/os.h>
+#include <corelib/memory.h>
+#include <corelib/allocator.h>
+#include <corelib/array.inl>
+#include <corelib/cdb.h>
+#include <corelib/task.h>
+
+// Headless CDB benchmark. Each result is one csv line on stdout:
+// bench,objects,ops,total_ns,ns_per_op
+// Alloc stress run check result and exit with 1 on duplicate object id or
+// lost value.
+// Usage: cdb_bench [max_objects]
+
+#define BENCH_MIN_OBJECTS 1000
+#define BENCH_MAX_OBJECTS 1000000
+
+#define BENCH_TYPE 1
+#define BENCH_PROP 2
+#define BENCH_PROP_COUNT 16
+#define BENCH_CHAIN_DEPTH 4
+#define BENCH_COMPONENTS 8
+#define BENCH_DUMP_PROPS 64
+#define BENCH_LOAD_BATCH 10000
+#define BENCH_IMAGE_PATH "cdb_bench.image"
+#define BENCH_NOTIFY_COMMITS 10
+#define BENCH_STRESS_HOT 64
+#define BENCH_STRESS_GRAIN 256
+#define BENCH_ALLOC_ROUNDS 4
+#define BENCH_ALLOC_GC_EVERY 1024
+
+static struct _G {
+    struct ct_alloc *allocator;
+    struct ct_cdb_t db;
+    uint64_t *objs;
+    uint64_t freq;
+    uint64_t notify_calls;
+} _G;
+
+static uint64_t _begin() {
+    return ct_os_a0->time->perf_counter();
+}
+
+static void _end(const char *bench,
+                 uint32_t objects,
+                 uint64_t ops,
+                 uint64_t begin) {
+    const uint64_t end = ct_os_a0->time->perf_counter();
+    const double ns = ((double) (end - begin) * 1e9) / _G.freq;
+
+    printf("%s,%u,%" PRIu64 ",%.0f,%.2f\n", bench, objects, ops, ns,
+           ops ? ns / ops : 0.0);
+    fflush(stdout);
+}
+
+static void _create_objects(uint32_t n) {
+    ct_array_resize(_G.objs, n, _G.allocator);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        _G.objs[i] = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+    }
+}
+
+static void _destroy_objects(uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        ct_cdb_a0->destroy_object(_G.objs[i]);
+    }
+
+    ct_cdb_a0->gc();
+}
+
+static void bench_create_destroy(uint32_t n) {
+    uint64_t begin = _begin();
+    _create_objects(n);
+    _end("create_object", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        ct_cdb_a0->destroy_object(_G.objs[i]);
+    }
+    _end("destroy_object", n, n, begin);
+
+    begin = _begin();
+    ct_cdb_a0->gc();
+    _end("gc", n, n, begin);
+}
+
+static void bench_write_read(uint32_t n) {
+    const float value[16] = {};
+    const uint8_t blob[16] = {};
+
+    _create_objects(n);
+
+    // write
+    static const char *write_name[] = {
+            "write_uint64", "write_float", "write_bool", "write_vec3",
+            "write_mat4", "write_str", "write_ref", "write_blob",
+    };
+
+    for (uint32_t t = 0; t < CT_ARRAY_LEN(write_name); ++t) {
+        const uint64_t begin = _begin();
+
+        for (uint32_t i = 0; i < n; ++i) {
+            ct_cdb_obj_o *w = ct_cdb_a0->write_begin(_G.objs[i]);
+            const uint64_t prop = BENCH_PROP + t;
+
+            switch (t) {
+                case 0:
+                    ct_cdb_a0->set_uint64(w, prop, i);
+                    break;
+                case 1:
+                    ct_cdb_a0->set_float(w, prop, i);
+                    break;
+                case 2:
+                    ct_cdb_a0->set_bool(w, prop, i & 1);
+                    break;
+                case 3:
+                    ct_cdb_a0->set_vec3(w, prop, value);
+                    break;
+                case 4:
+                    ct_cdb_a0->set_mat4(w, prop, value);
+                    break;
+                case 5:
+                    ct_cdb_a0->set_str(w, prop, (i & 1) ? "odd" : "even");
+                    break;
+                case 6:
+                    ct_cdb_a0->set_ref(w, prop, _G.objs[(i + 1) % n]);
+                    break;
+                default:
+                    ct_cdb_a0->set_blob(w, prop, (void *) blob,
+                                        sizeof(blob));
+                    break;
+            }
+
+            ct_cdb_a0->write_commit(w);
+        }
+
+        _end(write_name[t], n, n, begin);
+    }
+
+    // read
+    uint64_t sum = 0;
+    float mat[16];
+
+    uint64_t begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += ct_cdb_a0->read_uint64(_G.objs[i], BENCH_PROP, 0);
+    }
+    _end("read_uint64", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += ct_cdb_a0->read_float(_G.objs[i], BENCH_PROP + 1, 0);
+    }
+    _end("read_float", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += ct_cdb_a0->read_bool(_G.objs[i], BENCH_PROP + 2, false);
+    }
+    _end("read_bool", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        ct_cdb_a0->read_vec3(_G.objs[i], BENCH_PROP + 3, mat);
+        sum += mat[0];
+    }
+    _end("read_vec3", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        ct_cdb_a0->read_mat4(_G.objs[i], BENCH_PROP + 4, mat);
+        sum += mat[15];
+    }
+    _end("read_mat4", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += *ct_cdb_a0->read_str(_G.objs[i], BENCH_PROP + 5, "");
+    }
+    _end("read_str", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += ct_cdb_a0->read_ref(_G.objs[i], BENCH_PROP + 6, 0);
+    }
+    _end("read_ref", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t size = 0;
+        ct_cdb_a0->read_blob(_G.objs[i], BENCH_PROP + 7, &size, NULL);
+        sum += size;
+    }
+    _end("read_blob", n, n, begin);
+
+    // Keep reads from being optimized out.
+    if (!sum) {
+        ct_log_a0->debug("cdb_bench", "sum %" PRIu64, sum);
+    }
+
+    _destroy_objects(n);
+}
+
+static void bench_prefab_chain(uint32_t n) {
+    uint64_t chain[BENCH_CHAIN_DEPTH];
+
+    for (uint32_t i = 0; i < BENCH_CHAIN_DEPTH; ++i) {
+        chain[i] = !i ? ct_cdb_a0->create_object(_G.db, BENCH_TYPE)
+                      : ct_cdb_a0->create_from(_G.db, chain[i - 1]);
+
+        ct_cdb_obj_o *w = ct_cdb_a0->write_begin(chain[i]);
+        ct_cdb_a0->set_float(w, BENCH_PROP + i, i);
+        ct_cdb_a0->write_commit(w);
+    }
+
+    ct_array_resize(_G.objs, n, _G.allocator);
+    for (uint32_t i = 0; i < n; ++i) {
+        _G.objs[i] = ct_cdb_a0->create_from(_G.db,
+                                            chain[BENCH_CHAIN_DEPTH - 1]);
+    }
+
+    // Value from root of chain.
+    float sum = 0;
+    uint64_t begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += ct_cdb_a0->read_float(_G.objs[i], BENCH_PROP, 0);
+    }
+    _end("prefab_chain_read", n, n, begin);
+
+    if (sum < 0) {
+        ct_log_a0->debug("cdb_bench", "sum %f", sum);
+    }
+
+    _destroy_objects(n);
+
+    for (uint32_t i = 0; i < BENCH_CHAIN_DEPTH; ++i) {
+        ct_cdb_a0->destroy_object(chain[BENCH_CHAIN_DEPTH - 1 - i]);
+    }
+
+    ct_cdb_a0->gc();
+}
+
+static void bench_create_from(uint32_t n) {
+    uint64_t prefab = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+    uint64_t components = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+
+    ct_cdb_obj_o *cw = ct_cdb_a0->write_begin(components);
+    for (uint32_t i = 0; i < BENCH_COMPONENTS; ++i) {
+        uint64_t component = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+
+        ct_cdb_obj_o *w = ct_cdb_a0->write_begin(component);
+        for (uint32_t j = 0; j < BENCH_PROP_COUNT; ++j) {
+            ct_cdb_a0->set_float(w, BENCH_PROP + j, j);
+        }
+        ct_cdb_a0->write_commit(w);
+
+        ct_cdb_a0->set_subobject(cw, BENCH_PROP + i, component);
+    }
+    ct_cdb_a0->write_commit(cw);
+
+    ct_cdb_obj_o *w = ct_cdb_a0->write_begin(prefab);
+    ct_cdb_a0->set_subobject(w, BENCH_PROP, components);
+    ct_cdb_a0->write_commit(w);
+
+    ct_array_resize(_G.objs, n, _G.allocator);
+
+    uint64_t begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        _G.objs[i] = ct_cdb_a0->create_from(_G.db, prefab);
+    }
+    _end("create_from", n, n, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t c = ct_cdb_a0->read_subobject(_G.objs[i], BENCH_PROP, 0);
+        ct_cdb_a0->read_subobject(c, BENCH_PROP, 0);
+    }
+    _end("create_from_subobject_read", n, n * 2, begin);
+
+    _destroy_objects(n);
+
+    ct_cdb_a0->destroy_object(prefab);
+    ct_cdb_a0->gc();
+}
+
+static void bench_dump_load(uint32_t n) {
+    uint64_t obj = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+
+    ct_cdb_obj_o *w = ct_cdb_a0->write_begin(obj);
+    for (uint32_t i = 0; i < BENCH_DUMP_PROPS; ++i) {
+        if (i & 1) {
+            ct_cdb_a0->set_str(w, BENCH_PROP + i, "bench");
+        } else {
+            ct_cdb_a0->set_float(w, BENCH_PROP + i, i);
+        }
+    }
+    ct_cdb_a0->write_commit(w);
+
+    char *output = NULL;
+    uint64_t begin = _begin();
+    for (uint32_t i = 0; i < n; ++i) {
+        ct_array_clean(output);
+        ct_cdb_a0->dump(obj, &output, _G.allocator);
+    }
+    _end("dump", n, n, begin);
+
+    // Load take input, objects are destroyed in batches to bound memory.
+    const uint32_t size = ct_array_size(output);
+    ct_array_resize(_G.objs, BENCH_LOAD_BATCH, _G.allocator);
+
+    double ns = 0;
+    for (uint32_t done = 0; done < n; done += BENCH_LOAD_BATCH) {
+        const uint32_t batch_n = (n - done) < BENCH_LOAD_BATCH
+                                 ? (n - done) : BENCH_LOAD_BATCH;
+
+        for (uint32_t i = 0; i < batch_n; ++i) {
+            _G.objs[i] = ct_cdb_a0->create_object(_G.db, 0);
+        }
+
+        begin = _begin();
+        for (uint32_t i = 0; i < batch_n; ++i) {
+            char *input = CT_ALLOC(_G.allocator, char, size);
+            memcpy(input, output, size);
+
+            ct_cdb_a0->load(_G.db, input, _G.objs[i], _G.allocator);
+        }
+        ns += ((double) (_begin() - begin) * 1e9) / _G.freq;
+
+        _destroy_objects(batch_n);
+    }
+
+    printf("load,%u,%u,%.0f,%.2f\n", n, n, ns, n ? ns / n : 0.0);
+
+    ct_array_free(output, _G.allocator);
+
+    ct_cdb_a0->destroy_object(obj);
+    ct_cdb_a0->gc();
+}
+
+static void bench_image(uint32_t n) {
+    struct ct_cdb_image_entry_t *entries = NULL;
+    ct_array_resize(entries, n, _G.allocator);
+
+    _create_objects(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        ct_cdb_obj_o *w = ct_cdb_a0->write_begin(_G.objs[i]);
+        for (uint32_t j = 0; j < BENCH_PROP_COUNT; ++j) {
+            ct_cdb_a0->set_float(w, BENCH_PROP + j, j);
+        }
+        ct_cdb_a0->set_str(w, BENCH_PROP + BENCH_PROP_COUNT, "bench");
+        ct_cdb_a0->write_commit(w);
+
+        entries[i] = (struct ct_cdb_image_entry_t) {
+                .key = i + 1,
+                .source_hash = i,
+                .obj = _G.objs[i],
+        };
+    }
+
+    uint64_t begin = _begin();
+    ct_cdb_a0->save_image(BENCH_IMAGE_PATH, entries, n);
+    _end("save_image", n, n, begin);
+
+    _destroy_objects(n);
+
+    // Every tenth source is changed and is not loaded.
+    for (uint32_t i = 0; i < n; i += 10) {
+        entries[i].source_hash = UINT64_MAX;
+    }
+
+    begin = _begin();
+    uint32_t loaded = ct_cdb_a0->load_image(_G.db, BENCH_IMAGE_PATH,
+                                            entries, n);
+    _end("load_image", n, loaded, begin);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        if (entries[i].obj) {
+            ct_cdb_a0->destroy_object(entries[i].obj);
+        }
+    }
+    ct_cdb_a0->gc();
+
+    remove(BENCH_IMAGE_PATH);
+    ct_array_free(entries, _G.allocator);
+}
+
+static void _on_change(uint64_t obj,
+                       const uint64_t *prop,
+                       uint32_t prop_count,
+                       void *data) {
+    ++_G.notify_calls;
+}
+
+static void bench_notify(uint32_t n) {
+    uint64_t prefab = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+
+    ct_array_resize(_G.objs, n, _G.allocator);
+    for (uint32_t i = 0; i < n; ++i) {
+        _G.objs[i] = ct_cdb_a0->create_from(_G.db, prefab);
+        ct_cdb_a0->register_notify(_G.objs[i], _on_change, NULL);
+    }
+
+    for (uint32_t deferred = 0; deferred < 2; ++deferred) {
+        ct_cdb_a0->set_notify_deferred(deferred);
+        _G.notify_calls = 0;
+
+        const uint64_t begin = _begin();
+        for (uint32_t i = 0; i < BENCH_NOTIFY_COMMITS; ++i) {
+            ct_cdb_obj_o *w = ct_cdb_a0->write_begin(prefab);
+            ct_cdb_a0->set_float(w, BENCH_PROP, i);
+            ct_cdb_a0->write_commit(w);
+        }
+        ct_cdb_a0->flush_notify();
+
+        _end(deferred ? "notify_fanout_deferred" : "notify_fanout", n,
+             _G.notify_calls, begin);
+    }
+
+    ct_cdb_a0->set_notify_deferred(false);
+
+    _destroy_objects(n);
+
+    ct_cdb_a0->destroy_object(prefab);
+    ct_cdb_a0->gc();
+}
+
+// Workers commit to few hot objects and read all.
+static void _stress_work(uint32_t begin,
+                         uint32_t end,
+                         void *data) {
+    const uint32_t n = *(uint32_t *) data;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        uint64_t hot = _G.objs[i % BENCH_STRESS_HOT];
+
+        ct_cdb_obj_o *w = ct_cdb_a0->write_begin(hot);
+        ct_cdb_a0->set_uint64(w, BENCH_PROP + (i & 3), i);
+        ct_cdb_a0->write_commit(w);
+
+        ct_cdb_a0->read_uint64(_G.objs[(i * 7) % n], BENCH_PROP, 0);
+    }
+}
+
+static void bench_stress(uint32_t n) {
+    _create_objects(n);
+
+    const uint64_t begin = _begin();
+    ct_task_a0->parallel_for(0, n, BENCH_STRESS_GRAIN, _stress_work, &n);
+    _end("stress_hot_write", n, n, begin);
+
+    _destroy_objects(n);
+}
+
+static uint64_t _alloc_value(uint32_t round,
+                             uint32_t i) {
+    return ((uint64_t) round << 32) | i;
+}
+
+// Workers destroy object of last round and create new one at same index,
+// some of them run gc meanwhile, so freed ids are reused concurrently.
+static void _alloc_work(uint32_t begin,
+                        uint32_t end,
+                        void *data) {
+    const uint32_t round = *(uint32_t *) data;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        if (round) {
+            ct_cdb_a0->destroy_object(_G.objs[i]);
+        }
+
+        uint64_t obj = ct_cdb_a0->create_object(_G.db, BENCH_TYPE);
+
+        ct_cdb_obj_o *w = ct_cdb_a0->write_begin(obj);
+        ct_cdb_a0->set_uint64(w, BENCH_PROP, _alloc_value(round, i));
+        ct_cdb_a0->write_commit(w);
+
+        _G.objs[i] = obj;
+
+        if (!(i % BENCH_ALLOC_GC_EVERY)) {
+            ct_cdb_a0->gc();
+        }
+    }
+}
+
+static int _objid_cmp(const void *a,
+                      const void *b) {
+    const uint64_t id_a = *(const uint64_t *) a;
+    const uint64_t id_b = *(const uint64_t *) b;
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+static bool _alloc_check(uint32_t n,
+                         uint32_t round) {
+    bool ok = true;
+
+    uint64_t *ids = NULL;
+    ct_array_push_n(ids, _G.objs, n, _G.allocator);
+    qsort(ids, n, sizeof(uint64_t), _objid_cmp);
+
+    for (uint32_t i = 1; i < n; ++i) {
+        if (ids[i] == ids[i - 1]) {
+            ct_log_a0->error("cdb_bench", "stress_alloc: duplicate id %"
+                                          PRIx64, ids[i]);
+            ok = false;
+            break;
+        }
+    }
+
+    ct_array_free(ids, _G.allocator);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint64_t value = ct_cdb_a0->read_uint64(_G.objs[i],
+                                                      BENCH_PROP, 0);
+
+        if (value != _alloc_value(round, i)) {
+            ct_log_a0->error("cdb_bench", "stress_alloc: lost value %u",
+                             i);
+            ok = false;
+            break;
+        }
+    }
+
+    return ok;
+}
+
+static bool bench_stress_alloc(uint32_t n) {
+    ct_array_resize(_G.objs, n, _G.allocator);
+
+    bool ok = true;
+    uint64_t ticks = 0;
+
+    for (uint32_t round = 0; ok && (round < BENCH_ALLOC_ROUNDS); ++round) {
+        const uint64_t begin = _begin();
+        ct_task_a0->parallel_for(0, n, BENCH_STRESS_GRAIN, _alloc_work,
+                                 &round);
+        ticks += _begin() - begin;
+
+        ok = _alloc_check(n, round);
+    }
+
+    // Checks are not measured.
+    _end("stress_alloc", n, (uint64_t) n * BENCH_ALLOC_ROUNDS,
+         _begin() - ticks);
+
+    _destroy_objects(n);
+
+    return ok;
+}
+
+int main(int argc,
+         const char **argv) {
+    ct_corelib_init();
+    ct_task_a0->start();
+
+    _G = (struct _G) {
+            .allocator = ct_memory_a0->system,
+            .db = ct_cdb_a0->db(),
+            .freq = ct_os_a0->time->perf_freq(),
+    };
+
+    const uint32_t max_objects = (argc > 1)
+                                 ? (uint32_t) strtoul(argv[1], NULL, 10)
+                                 : BENCH_MAX_OBJECTS;
+
+    printf("bench,objects,ops,total_ns,ns_per_op\n");
+
+    bool ok = true;
+
+    for (uint32_t n = BENCH_MIN_OBJECTS; n <= max_objects; n *= 10) {
+        bench_create_destroy(n);
+        bench_write_read(n);
+        bench_prefab_chain(n);
+        bench_create_from(n);
+        bench_dump_load(n);
+        bench_image(n);
+        bench_notify(n);
+        bench_stress(n);
+        ok &= bench_stress_alloc(n);
+    }
+
+    ct_array_free(_G.objs, _G.allocator);
+
+    ct_corelib_shutdown();
+
+    return ok ? 0 : 1;
+}
@@ -204,6 +204,7 @@ int main(int argc,
     ct_log_a0->register_handler(ct_log_a0->stdout_handler, NULL);
 
     ct_corelib_init();
+    ct_task_a0->start();
 
     ct_os_a0->path->make_path("./docs/gen/");
 
@@ -226,8 +227,11 @@ int main(int argc,
     struct ct_task_counter_t *counter = NULL;
 
     for (uint32_t i = 0; i < files_count; ++i) {
-        tasks[i].data = files[i];
-        tasks[i].work = process_file;
+        tasks[i] = (struct ct_task_item) {
+                .name = "process_file",
+                .work = process_file,
+                .data = files[i],
+        };
     }
 
     ct_task_a0->add(tasks, files_count, &counter);
@@ -103,6 +103,7 @@ int main(int argc,
     ct_log_a0->register_handler(ct_log_a0->stdout_handler, NULL);
 
     ct_corelib_init();
+    ct_task_a0->start();
 
     char **files;
     uint32_t files_count;
@@ -117,8 +118,11 @@ int main(int argc,
     struct ct_task_counter_t *counter2 = NULL;
 
     for (uint32_t i = 0; i < files_count; ++i) {
-        tasks[i].data = files[i];
-        tasks[i].work = process_file;
+        tasks[i] = (struct ct_task_item) {
+                .name = "process_file",
+                .work = process_file,
+                .data = files[i],
+        };
     }
 
     ct_task_a0->add(tasks, files_count, &counter);
@@ -129,8 +133,11 @@ int main(int argc,
 
     struct ct_task_item tasks2[files_count];
     for (uint32_t i = 0; i < files_count; ++i) {
-        tasks2[i].data = files[i];
-        tasks2[i].work = process_file;
+        tasks2[i] = (struct ct_task_item) {
+                .name = "process_file",
+                .work = process_file,
+                .data = files[i],
+        };
     }
 
     ct_task_a0->add(tasks2, files_count, &counter2);
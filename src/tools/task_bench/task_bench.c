@@ -0,0 +1,523 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include <corelib/core.h>
+#include <corelib/log.h>
+#include <corelib/os.h>
+#include <corelib/memory.h>
+#include <corelib/allocator.h>
+#include <corelib/hashlib.h>
+#include <corelib/config.h>
+#include <corelib/cdb.h>
+#include <corelib/task.h>
+
+// Headless task system benchmark. Each result is one csv line on stdout:
+// bench,workers,tasks,total_ns,ns_per_task
+// Worker count is set before start, run once per count to compare them.
+// Sweep run bench in new process for 1, 2, 4 ... cpu count workers.
+// Stress and graph runs check result and exit with 1 if some task was lost
+// or run before its dependencies.
+// Usage: task_bench [worker_count] [tasks] [fibers] [header]
+//        task_bench sweep [tasks] [fibers]
+
+#define BENCH_TASKS 100000
+#define BENCH_HEADER "bench,workers,tasks,total_ns,ns_per_task\n"
+#define SWEEP_CMD_SIZE 1024
+#define BENCH_FANOUT 64
+#define ALLOC_BATCH 8
+#define STRESS_FANOUT 4
+#define STRESS_DEPTH 7
+#define GRAPH_GROUPS 8
+#define GRAPH_GROUP_TASKS 16
+#define GRAPH_JOIN_TASKS 16
+#define PFOR_ITEM_WORK 64
+#define PFOR_TINY 16
+#define PFOR_TINY_REPS 10000
+#define PFOR_LARGE (1u << 20)
+#define PFOR_LARGE_REPS 8
+
+static struct _G {
+    struct ct_alloc *allocator;
+    uint32_t workers;
+    uint64_t freq;
+    atomic_uint done;
+
+    atomic_uint graph_group[GRAPH_GROUPS];
+    atomic_uint graph_second;
+    atomic_uint graph_join;
+    atomic_uint graph_bad;
+} _G;
+
+static uint64_t _begin() {
+    return ct_os_a0->time->perf_counter();
+}
+
+static void _end(const char *bench,
+                 uint64_t tasks,
+                 uint64_t begin) {
+    const uint64_t end = ct_os_a0->time->perf_counter();
+    const double ns = ((double) (end - begin) * 1e9) / _G.freq;
+
+    printf("%s,%u,%" PRIu64 ",%.0f,%.2f\n", bench, _G.workers, tasks, ns,
+           tasks ? ns / tasks : 0.0);
+    fflush(stdout);
+}
+
+static void _leaf(void *data) {
+    CT_UNUSED(data);
+    atomic_fetch_add_explicit(&_G.done, 1, memory_order_relaxed);
+}
+
+// Main thread add all tasks at once, workers take them from shared queue
+// and steal from each other.
+static void bench_add_wait(uint32_t n) {
+    struct ct_task_item *items = CT_ALLOC(_G.allocator, struct ct_task_item,
+                                          sizeof(struct ct_task_item) * n);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        items[i] = (struct ct_task_item) {
+                .name = "leaf",
+                .work = _leaf,
+        };
+    }
+
+    struct ct_task_counter_t *counter;
+
+    const uint64_t begin = _begin();
+    ct_task_a0->add(items, n, &counter);
+    ct_task_a0->wait_for_counter(counter, 0);
+    _end("add_wait", n, begin);
+
+    CT_FREE(_G.allocator, items);
+}
+
+// Tasks spawned from worker go to its own queue.
+static void _spawn(void *data) {
+    CT_UNUSED(data);
+
+    struct ct_task_item items[BENCH_FANOUT];
+    for (uint32_t i = 0; i < BENCH_FANOUT; ++i) {
+        items[i] = (struct ct_task_item) {
+                .name = "leaf",
+                .work = _leaf,
+        };
+    }
+
+    struct ct_task_counter_t *counter;
+    ct_task_a0->add(items, BENCH_FANOUT, &counter);
+    ct_task_a0->wait_for_counter(counter, 0);
+}
+
+static void bench_worker_spawn(uint32_t n) {
+    const uint32_t spawn_n = n / BENCH_FANOUT;
+
+    struct ct_task_item *items = CT_ALLOC(_G.allocator, struct ct_task_item,
+                                          sizeof(struct ct_task_item) *
+                                          spawn_n);
+
+    for (uint32_t i = 0; i < spawn_n; ++i) {
+        items[i] = (struct ct_task_item) {
+                .name = "spawn",
+                .work = _spawn,
+        };
+    }
+
+    struct ct_task_counter_t *counter;
+
+    const uint64_t begin = _begin();
+    ct_task_a0->add(items, spawn_n, &counter);
+    ct_task_a0->wait_for_counter(counter, 0);
+    _end("worker_spawn", spawn_n * (BENCH_FANOUT + 1), begin);
+
+    CT_FREE(_G.allocator, items);
+}
+
+// Half of tasks add children one by one (single pool alloc), other half at
+// once (batch alloc), both race on the same pool free list.
+static void _alloc_mixed(void *data) {
+    struct ct_task_item items[ALLOC_BATCH];
+    for (uint32_t i = 0; i < ALLOC_BATCH; ++i) {
+        items[i] = (struct ct_task_item) {
+                .name = "leaf",
+                .work = _leaf,
+        };
+    }
+
+    struct ct_task_counter_t *counter[ALLOC_BATCH];
+
+    if ((uintptr_t) data & 1) {
+        ct_task_a0->add(items, ALLOC_BATCH, &counter[0]);
+        ct_task_a0->wait_for_counter(counter[0], 0);
+        return;
+    }
+
+    for (uint32_t i = 0; i < ALLOC_BATCH; ++i) {
+        ct_task_a0->add(&items[i], 1, &counter[i]);
+    }
+
+    for (uint32_t i = 0; i < ALLOC_BATCH; ++i) {
+        ct_task_a0->wait_for_counter(counter[i], 0);
+    }
+}
+
+static void bench_alloc_mixed(uint32_t n) {
+    const uint32_t spawn_n = n / (ALLOC_BATCH + 1);
+
+    struct ct_task_item *items = CT_ALLOC(_G.allocator, struct ct_task_item,
+                                          sizeof(struct ct_task_item) *
+                                          spawn_n);
+
+    for (uint32_t i = 0; i < spawn_n; ++i) {
+        items[i] = (struct ct_task_item) {
+                .name = "alloc_mixed",
+                .work = _alloc_mixed,
+                .data = (void *) (uintptr_t) i,
+        };
+    }
+
+    struct ct_task_counter_t *counter;
+
+    const uint64_t begin = _begin();
+    ct_task_a0->add(items, spawn_n, &counter);
+    ct_task_a0->wait_for_counter(counter, 0);
+    _end("alloc_mixed", spawn_n * (ALLOC_BATCH + 1), begin);
+
+    CT_FREE(_G.allocator, items);
+}
+
+// Every node wait for half of children (nonzero wait) and then for all,
+// waits nest STRESS_DEPTH deep and children are stolen by other workers.
+static void _stress(void *data) {
+    const uint32_t depth = (uint32_t) (uintptr_t) data;
+
+    if (!depth) {
+        _leaf(NULL);
+        return;
+    }
+
+    struct ct_task_item items[STRESS_FANOUT];
+    for (uint32_t i = 0; i < STRESS_FANOUT; ++i) {
+        items[i] = (struct ct_task_item) {
+                .name = "stress",
+                .work = _stress,
+                .data = (void *) (uintptr_t) (depth - 1),
+        };
+    }
+
+    struct ct_task_counter_t *counter;
+    ct_task_a0->add(items, STRESS_FANOUT, &counter);
+    ct_task_a0->wait_for_counter(counter, STRESS_FANOUT / 2);
+    ct_task_a0->wait_for_counter(counter, 0);
+}
+
+static bool bench_stress() {
+    uint32_t leaf_n = 1;
+    uint32_t task_n = 0;
+    for (uint32_t i = 0; i < STRESS_DEPTH; ++i) {
+        task_n += leaf_n;
+        leaf_n *= STRESS_FANOUT;
+    }
+    task_n += leaf_n;
+
+    atomic_store(&_G.done, 0);
+
+    struct ct_task_item item = {
+            .name = "stress",
+            .work = _stress,
+            .data = (void *) (uintptr_t) STRESS_DEPTH,
+    };
+
+    struct ct_task_counter_t *counter;
+
+    const uint64_t begin = _begin();
+    ct_task_a0->add(&item, 1, &counter);
+    ct_task_a0->wait_for_counter(counter, 0);
+    _end("stress", task_n, begin);
+
+    const uint32_t done = atomic_load(&_G.done);
+    if (done != leaf_n) {
+        ct_log_a0->error("task_bench", "stress: %u leafs of %u done",
+                         done, leaf_n);
+        return false;
+    }
+
+    return true;
+}
+
+// Fan-out: every group has first and second stage, second stage run after
+// first stage of its group. Join run after all first stages and second
+// stages. In odd rounds half of second stages is waited before join, so
+// join depends on first stages that are already fired.
+static void _graph_first(void *data) {
+    const uint32_t group = (uint32_t) (uintptr_t) data;
+    atomic_fetch_add(&_G.graph_group[group], 1);
+}
+
+static void _graph_second(void *data) {
+    const uint32_t group = (uint32_t) (uintptr_t) data;
+
+    if (atomic_load(&_G.graph_group[group]) != GRAPH_GROUP_TASKS) {
+        atomic_fetch_add(&_G.graph_bad, 1);
+    }
+
+    atomic_fetch_add(&_G.graph_second, 1);
+}
+
+static void _graph_join(void *data) {
+    CT_UNUSED(data);
+
+    if (atomic_load(&_G.graph_second) != GRAPH_GROUPS * GRAPH_GROUP_TASKS) {
+        atomic_fetch_add(&_G.graph_bad, 1);
+    }
+
+    atomic_fetch_add(&_G.graph_join, 1);
+}
+
+static void _graph_round(uint32_t round) {
+    struct ct_task_item first[GRAPH_GROUP_TASKS];
+    struct ct_task_item second[GRAPH_GROUP_TASKS];
+    struct ct_task_item join[GRAPH_JOIN_TASKS];
+
+    struct ct_task_counter_t *first_counter[GRAPH_GROUPS];
+    struct ct_task_counter_t *second_counter[GRAPH_GROUPS];
+
+    for (uint32_t i = 0; i < GRAPH_GROUPS; ++i) {
+        atomic_store(&_G.graph_group[i], 0);
+    }
+
+    atomic_store(&_G.graph_second, 0);
+    atomic_store(&_G.graph_join, 0);
+
+    for (uint32_t g = 0; g < GRAPH_GROUPS; ++g) {
+        for (uint32_t i = 0; i < GRAPH_GROUP_TASKS; ++i) {
+            first[i] = (struct ct_task_item) {
+                    .name = "graph_first",
+                    .work = _graph_first,
+                    .data = (void *) (uintptr_t) g,
+            };
+
+            second[i] = (struct ct_task_item) {
+                    .name = "graph_second",
+                    .work = _graph_second,
+                    .data = (void *) (uintptr_t) g,
+            };
+        }
+
+        ct_task_a0->add(first, GRAPH_GROUP_TASKS, &first_counter[g]);
+        ct_task_a0->add_after(second, GRAPH_GROUP_TASKS,
+                              &first_counter[g], 1, &second_counter[g]);
+    }
+
+    struct ct_task_counter_t *deps[GRAPH_GROUPS * 2];
+    uint32_t deps_n = 0;
+
+    for (uint32_t g = 0; g < GRAPH_GROUPS; ++g) {
+        deps[deps_n++] = first_counter[g];
+
+        // Fired first stage is still valid dependency until released.
+        if ((round & 1) && (g < GRAPH_GROUPS / 2)) {
+            ct_task_a0->wait_for_counter(second_counter[g], 0);
+            continue;
+        }
+
+        deps[deps_n++] = second_counter[g];
+    }
+
+    for (uint32_t i = 0; i < GRAPH_JOIN_TASKS; ++i) {
+        join[i] = (struct ct_task_item) {
+                .name = "graph_join",
+                .work = _graph_join,
+        };
+    }
+
+    struct ct_task_counter_t *join_counter;
+    ct_task_a0->add_after(join, GRAPH_JOIN_TASKS, deps, deps_n,
+                          &join_counter);
+    ct_task_a0->wait_for_counter(join_counter, 0);
+
+    if (atomic_load(&_G.graph_join) != GRAPH_JOIN_TASKS) {
+        atomic_fetch_add(&_G.graph_bad, 1);
+    }
+
+    for (uint32_t i = 0; i < deps_n; ++i) {
+        ct_task_a0->wait_for_counter(deps[i], 0);
+    }
+}
+
+static void _graph(void *data) {
+    const uint32_t rounds = (uint32_t) (uintptr_t) data;
+
+    for (uint32_t i = 0; i < rounds; ++i) {
+        _graph_round(i);
+    }
+}
+
+// Graph is built by main thread and by worker, worker wait for
+// dependencies on fiber when fibers are enabled.
+static bool bench_graph(uint32_t n) {
+    const uint32_t round_n = (GRAPH_GROUPS * GRAPH_GROUP_TASKS * 2) +
+                             GRAPH_JOIN_TASKS;
+    const uint32_t rounds = n / round_n;
+
+    atomic_store(&_G.graph_bad, 0);
+
+    uint64_t begin = _begin();
+    _graph((void *) (uintptr_t) rounds);
+    _end("graph", rounds * round_n, begin);
+
+    struct ct_task_item item = {
+            .name = "graph",
+            .work = _graph,
+            .data = (void *) (uintptr_t) rounds,
+    };
+
+    struct ct_task_counter_t *counter;
+
+    begin = _begin();
+    ct_task_a0->add(&item, 1, &counter);
+    ct_task_a0->wait_for_counter(counter, 0);
+    _end("graph_worker", rounds * round_n, begin);
+
+    const uint32_t bad = atomic_load(&_G.graph_bad);
+    if (bad) {
+        ct_log_a0->error("task_bench", "graph: %u tasks run out of order",
+                         bad);
+        return false;
+    }
+
+    return true;
+}
+
+static void _pfor_work(uint32_t begin,
+                       uint32_t end,
+                       void *data) {
+    float *out = data;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        float x = (float) i;
+        for (uint32_t j = 0; j < PFOR_ITEM_WORK; ++j) {
+            x = (x * 0.999f) + 1.0f;
+        }
+
+        out[i] = x;
+    }
+}
+
+// Same range with parallel_for and serial loop, parallel_for should never
+// be slower. Tiny range is mostly split overhead.
+static void bench_parallel_for(const char *parallel_bench,
+                               const char *serial_bench,
+                               uint32_t n,
+                               uint32_t reps) {
+    float *out = CT_ALLOC(_G.allocator, float, sizeof(float) * n);
+
+    // Serial loop call work through pointer like parallel_for, inlined
+    // work is compiled differently.
+    ct_task_range_work_t volatile work = _pfor_work;
+
+    uint64_t begin = _begin();
+    for (uint32_t i = 0; i < reps; ++i) {
+        ct_task_a0->parallel_for(0, n, 1, _pfor_work, out);
+    }
+    _end(parallel_bench, (uint64_t) n * reps, begin);
+
+    begin = _begin();
+    for (uint32_t i = 0; i < reps; ++i) {
+        work(0, n, out);
+    }
+    _end(serial_bench, (uint64_t) n * reps, begin);
+
+    CT_FREE(_G.allocator, out);
+}
+
+static int _sweep(const char *exe,
+                  uint32_t tasks,
+                  bool fibers) {
+    const int cpu_count = ct_os_a0->cpu->count();
+    const uint32_t max_workers = cpu_count > 1 ? (uint32_t) cpu_count : 1;
+
+    printf(BENCH_HEADER);
+    fflush(stdout);
+
+    int result = 0;
+    uint32_t workers = 1;
+    while (true) {
+        char cmd[SWEEP_CMD_SIZE];
+        snprintf(cmd, CT_ARRAY_LEN(cmd), "%s %u %u %u 0", exe, workers, tasks,
+                 fibers);
+
+        if (ct_os_a0->process->exec(cmd)) {
+            result = 1;
+        }
+
+        if (workers >= max_workers) {
+            break;
+        }
+
+        workers = (workers * 2) < max_workers ? workers * 2 : max_workers;
+    }
+
+    return result;
+}
+
+int main(int argc,
+         const char **argv) {
+    ct_corelib_init();
+
+    _G = (struct _G) {
+            .allocator = ct_memory_a0->system,
+            .freq = ct_os_a0->time->perf_freq(),
+    };
+
+    const bool sweep = (argc > 1) && !strcmp(argv[1], "sweep");
+
+    const uint32_t workers = (argc > 1)
+                             ? (uint32_t) strtoul(argv[1], NULL, 10) : 0;
+
+    const uint32_t tasks = (argc > 2)
+                           ? (uint32_t) strtoul(argv[2], NULL, 10)
+                           : BENCH_TASKS;
+
+    const bool fibers = (argc > 3) && strtoul(argv[3], NULL, 10);
+    const bool header = (argc <= 4) || strtoul(argv[4], NULL, 10);
+
+    if (sweep) {
+        const int result = _sweep(argv[0], tasks, fibers);
+        ct_corelib_shutdown();
+        return result;
+    }
+
+    ct_cdb_obj_o *writer = ct_cdb_a0->write_begin(ct_config_a0->obj());
+    ct_cdb_a0->set_uint64(writer, CONFIG_TASK_WORKER_COUNT, workers);
+    ct_cdb_a0->set_uint64(writer, CONFIG_TASK_FIBERS, fibers);
+    ct_cdb_a0->write_commit(writer);
+
+    ct_task_a0->start();
+    _G.workers = (uint32_t) ct_task_a0->worker_count();
+
+    if (header) {
+        printf(BENCH_HEADER);
+    }
+
+    // First run is cold, it allocates pool pages and queues.
+    bench_add_wait(tasks);
+
+    bench_add_wait(tasks);
+    bench_worker_spawn(tasks);
+    bench_alloc_mixed(tasks);
+
+    bench_parallel_for("parallel_for_tiny", "serial_tiny",
+                       PFOR_TINY, PFOR_TINY_REPS);
+    bench_parallel_for("parallel_for_large", "serial_large",
+                       PFOR_LARGE, PFOR_LARGE_REPS);
+
+    bool ok = bench_stress();
+    ok &= bench_graph(tasks);
+
+    ct_corelib_shutdown();
+
+    return ok ? 0 : 1;
+}